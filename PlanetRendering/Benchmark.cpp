@@ -0,0 +1,271 @@
+//
+//  Benchmark.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+//  Headless benchmark of the terrain pipeline (PlanetBenchmark target).
+//  A planet is flown along a scripted camera path with every OpenGL call stubbed out (see HeadlessStubs.cpp), and the timings of its updates are written out as JSON.
+//  usage: PlanetBenchmark [output file (default benchmark.json)] [frame time in ms (default 16)] [frames per phase (default 300)] [tile cache file (default none)] [ocean (ocean mode)] [nospeculation (no refinement ahead of the camera)] [distance (the original DistanceLODMetric instead of the screen-space error metric)]
+//  Running twice with the same tile cache file measures a repeat session.
+//  Meanwhile a second thread keeps querying the terrain height around the camera (Planet::GetSurfaceRadius) while faces are split and combined under it;
+//  the run fails if a query returns anything but a plausible radius.
+//  After the path, the camera jumps to the far side of the planet, and the time until the first and last meshes for the new position are drawn is reported under "teleport".
+//
+
+#include "Planet.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    ///one stretch of the camera path; position(t) gives the camera position (relative to the planet) for t in [0,1]
+    struct FlightPhase
+    {
+        std::string name;
+        std::function<glm::dvec3(double)> position;
+    };
+
+    ///direction on the unit sphere from latitude and longitude (radians)
+    glm::dvec3 direction(double latitude, double longitude)
+    {
+        return glm::dvec3(std::cos(latitude) * std::cos(longitude), std::cos(latitude) * std::sin(longitude), std::sin(latitude));
+    }
+
+    double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty()) return 0;
+        std::sort(values.begin(), values.end());
+        std::size_t i = static_cast<std::size_t>(p * (values.size() - 1) + 0.5);
+        return values[i];
+    }
+
+    void printSeries(FILE* out, const char* name, const std::vector<double>& values, bool last)
+    {
+        double total = 0, maximum = 0;
+        for (double v : values)
+        {
+            total += v;
+            maximum = std::max(maximum, v);
+        }
+        std::fprintf(out, "        \"%s\": {\"total\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s\n", name, total,
+                    percentile(values, 0.5), percentile(values, 0.99), maximum, last ? "" : ",");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    //the results go to a file, since creating the (stubbed) shader programs already prints to stdout
+    const char* outputName = argc > 1 ? argv[1] : "benchmark.json";
+    const double frameTime = argc > 2 ? std::atof(argv[2]) : 16;
+    const int framesPerPhase = argc > 3 ? std::atoi(argv[3]) : 300;
+    const char* tileCachePath = argc > 4 ? argv[4] : "";
+    const bool oceanMode = argc > 5 && std::string(argv[5])=="ocean";
+    const bool speculation = !(argc > 6 && std::string(argv[6])=="nospeculation");
+    const bool distanceMetric = argc > 7 && std::string(argv[7])=="distance";
+    FILE* out = std::fopen(outputName, "w");
+    if (!out)
+    {
+        std::fprintf(stderr, "cannot open %s\n", outputName);
+        return 1;
+    }
+
+    const double radius = 1;
+    //close enough to the surface for faces near the camera to reach MAX_LOD
+    const double lowAltitude = 1.0e-6;
+    const double orbitAltitude = 0.5;
+    const std::vector<FlightPhase> path = {
+        {"orbit", [=](double t) { return direction(0.3, 2 * M_PI * t) * (radius + orbitAltitude); }},
+        //the altitude falls exponentially, so every level of detail gets a similar share of the frames
+        {"descent", [=](double t) { return direction(0.3, 0) * (radius + orbitAltitude * std::pow(lowAltitude / orbitAltitude, t)); }},
+        //a quarter of the way around the planet at ground level
+        {"traverse", [=](double t) { return direction(0.3 + 0.5 * M_PI * t, 0) * (radius + lowAltitude); }},
+    };
+
+    Player player(1280, 720);
+    GLManager glManager("fragmentShader.glsl", "vertexShader.glsl");
+    glManager.AddUniformBuffer("planet_info", sizeof(float), {0});
+    TaskPool taskPool;
+    player.Position = path.front().position(0);
+    player.Camera.position = vvec3(player.Position);
+    std::unique_ptr<Planet> planet(new Planet(0, glm::vec3(0, 0, 0), radius, 100, 3.0, player, glManager, taskPool, 0.3f));
+    planet->RecordTimings = true;
+    planet->SetTileCache(tileCachePath);
+    planet->OceanMode = oceanMode;
+    if (!speculation) planet->SpeculationLookahead = 0;
+    if (distanceMetric) planet->SetLODMetric(std::make_shared<DistanceLODMetric>(planet->LOD_MULTIPLIER));
+
+    //the concurrent reader: directions within about a hundredth of the radius of the camera's
+    std::mutex readerMutex;
+    glm::dvec3 readerTarget = player.Position;
+    std::atomic<bool> readerDone(false);
+    std::size_t surfaceQueries = 0, implausibleSurfaces = 0;
+    double lowestSurface = radius, highestSurface = radius;
+    std::thread reader([&]()
+    {
+        std::mt19937 random(1);
+        std::uniform_real_distribution<double> jitter(-0.01 * radius, 0.01 * radius);
+        while (!readerDone)
+        {
+            glm::dvec3 target;
+            {
+                std::lock_guard<std::mutex> lock(readerMutex);
+                target = readerTarget;
+            }
+            for (int i = 0; i < 64; i++)
+            {
+                double surface = planet->GetSurfaceRadius(vvec3(target + glm::dvec3(jitter(random), jitter(random), jitter(random))));
+                //the flat base faces dip to 0.79 of the radius at their centres, and the terrain rises a few percent above it
+                if (!(surface > 0.75 * radius && surface < 1.5 * radius)) implausibleSurfaces++;
+                lowestSurface = std::min(lowestSurface, surface);
+                highestSurface = std::max(highestSurface, surface);
+                surfaceQueries++;
+            }
+            std::this_thread::yield();
+        }
+    });
+
+    std::fprintf(out, "{\n  \"frame_ms\": %.3f,\n  \"frames_per_phase\": %d,\n  \"worker_threads\": %u,\n  \"ocean_mode\": %s,\n  \"speculation\": %s,\n", frameTime, framesPerPhase, taskPool.ThreadCount(), oceanMode ? "true" : "false", speculation ? "true" : "false");
+    //the SIMD terrain noise is checked against its scalar reference, so a broken batch path shows up here rather than as odd terrain
+    std::fprintf(out, "  \"noise\": {\"instruction_set\": \"%s\", \"max_batch_error\": %g},\n", TerrainNoise::BatchInstructionSet(), TerrainNoise(1).Verify(4099));
+    std::fprintf(out, "  \"phases\": [\n");
+    //the height cache counts hits and misses since the planet was created; each phase reports its own share
+    std::size_t cacheHits = 0, cacheMisses = 0, tileHits = 0, tileMisses = 0, frames = 0, insufficientFrames = 0;
+    double insufficientLeafFrames = 0;
+    for (std::size_t p = 0; p < path.size(); p++)
+    {
+        const FlightPhase& phase = path[p];
+        std::vector<double> draw;
+        std::size_t uploaded = 0;
+        for (int frame = 0; frame < framesPerPhase; frame++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            player.Position = phase.position(static_cast<double>(frame) / std::max(framesPerPhase - 1, 1));
+            player.Camera.position = vvec3(player.Position);
+            {
+                std::lock_guard<std::mutex> lock(readerMutex);
+                readerTarget = player.Position;
+            }
+            //the planet is held still (no time step), so the path stays in the planet's frame; this also wakes the update thread
+            planet->UpdatePhysics(0);
+            auto drawStart = std::chrono::high_resolution_clock::now();
+            planet->Draw();
+            draw.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - drawStart).count());
+            uploaded += planet->GetUploadSize();
+            std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<long long>(frameTime * 1000)));
+        }
+
+        std::vector<Planet::UpdateTimings> timings = planet->TakeUpdateTimings();
+        std::vector<double> lod, culling, extraction, publish, update;
+        std::size_t maxTriangles = 0, extracted = 0, cullTests = 0, cancelled = 0, maxFlatLeaves = 0, maxMeshTriangles = 0;
+        for (const Planet::UpdateTimings& t : timings)
+        {
+            lod.push_back(t.lod);
+            culling.push_back(t.culling);
+            extraction.push_back(t.extraction);
+            publish.push_back(t.publish);
+            update.push_back(t.lod + t.culling + t.extraction + t.publish);
+            maxTriangles = std::max(maxTriangles, t.triangles);
+            maxFlatLeaves = std::max(maxFlatLeaves, t.flatLeaves);
+            maxMeshTriangles = std::max(maxMeshTriangles, t.meshTriangles);
+            extracted += t.extractedPatches;
+            cullTests += t.cullTests;
+            cancelled += t.cancelled;
+        }
+
+        std::fprintf(out, "    {\n      \"name\": \"%s\",\n      \"updates\": %zu,\n", phase.name.c_str(), timings.size());
+        //updates dropped because the camera had moved too far from where they started (see Planet::UpdateRestartThreshold)
+        std::fprintf(out, "      \"cancelled_updates\": %zu,\n", cancelled);
+        std::fprintf(out, "      \"triangles\": {\"final\": %zu, \"max\": %zu},\n", planet->GetTriangleCount(), maxTriangles);
+        std::fprintf(out, "      \"mesh_triangles\": {\"final\": %zu, \"max\": %zu},\n", timings.empty() ? 0 : timings.back().meshTriangles, maxMeshTriangles);
+        std::fprintf(out, "      \"submerged_leaves\": %zu,\n", planet->GetSubmergedLeafCount());
+        //leaves the LOD metric wanted split but that were too flat; each would have added three triangles
+        std::fprintf(out, "      \"flat_leaves\": {\"final\": %zu, \"max\": %zu},\n", planet->GetFlatLeafCount(), maxFlatLeaves);
+        std::fprintf(out, "      \"visible_patches\": %zu,\n", timings.empty() ? 0 : timings.back().visiblePatches);
+        std::fprintf(out, "      \"extracted_patches\": %zu,\n", extracted);
+        //patches whose culling result was worked out again rather than kept from the previous update
+        std::fprintf(out, "      \"cull_tests\": %zu,\n", cullTests);
+        std::fprintf(out, "      \"uploaded_bytes\": %zu,\n", uploaded);
+        //frames drawn while the mesh was coarser than the camera called for
+        Planet::LODFrameStats lodFrames = planet->GetLODFrameStats();
+        std::fprintf(out, "      \"insufficient_lod_frames\": {\"frames\": %zu, \"insufficient\": %zu, \"mean_leaf_share\": %.5f},\n", lodFrames.Frames - frames, lodFrames.InsufficientFrames - insufficientFrames,
+                     lodFrames.Frames==frames ? 0.0 : (lodFrames.InsufficientLeafFrames - insufficientLeafFrames) / (lodFrames.Frames - frames));
+        frames = lodFrames.Frames;
+        insufficientFrames = lodFrames.InsufficientFrames;
+        insufficientLeafFrames = lodFrames.InsufficientLeafFrames;
+        std::fprintf(out, "      \"faces\": {\"live\": %zu, \"peak\": %zu},\n", planet->GetFacePoolStats().LiveNodes, planet->GetFacePoolStats().PeakNodes);
+        HeightCache::Stats heights = planet->GetHeightCacheStats();
+        std::fprintf(out, "      \"height_cache\": {\"hits\": %zu, \"misses\": %zu, \"hit_rate\": %.3f, \"entries\": %zu, \"bytes\": %zu},\n",
+                     heights.Hits - cacheHits, heights.Misses - cacheMisses,
+                     heights.Hits + heights.Misses - cacheHits - cacheMisses==0 ? 0.0 : static_cast<double>(heights.Hits - cacheHits) / (heights.Hits + heights.Misses - cacheHits - cacheMisses),
+                     heights.Entries, heights.BytesUsed);
+        cacheHits = heights.Hits;
+        cacheMisses = heights.Misses;
+        TerrainTileCache::Stats tiles = planet->GetTileCacheStats();
+        std::fprintf(out, "      \"tile_cache\": {\"hits\": %zu, \"misses\": %zu, \"entries\": %zu, \"slots\": %zu, \"file_bytes\": %zu},\n",
+                     tiles.Hits - tileHits, tiles.Misses - tileMisses, tiles.Entries, tiles.Slots, tiles.FileBytes);
+        tileHits = tiles.Hits;
+        tileMisses = tiles.Misses;
+        std::fprintf(out, "      \"timings_ms\": {\n");
+        printSeries(out, "split_merge", lod, false);
+        printSeries(out, "culling", culling, false);
+        printSeries(out, "extraction", extraction, false);
+        printSeries(out, "publish", publish, false);
+        printSeries(out, "update", update, false);
+        printSeries(out, "draw", draw, true);
+        std::fprintf(out, "      }\n    }%s\n", p + 1 < path.size() ? "," : "");
+    }
+    std::fprintf(out, "  ],\n");
+
+    //a jump to the far side of the planet at ground level: how long until the first mesh for the new position, and until the last refinement of it, is drawn
+    //the camera is held still first, so that no mesh made for the old position arrives after the jump
+    for (int frame = 0, quiet = 0; frame < framesPerPhase && quiet < 10; frame++)
+    {
+        planet->Draw();
+        quiet = planet->GetUploadSize() > 0 ? 0 : quiet + 1;
+        std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>(frameTime * 1000)));
+    }
+    player.Position = direction(-0.3, M_PI) * (radius + lowAltitude);
+    player.Camera.position = vvec3(player.Position);
+    {
+        std::lock_guard<std::mutex> lock(readerMutex);
+        readerTarget = player.Position;
+    }
+    auto jump = std::chrono::high_resolution_clock::now();
+    double firstMesh = -1, lastMesh = -1;
+    std::size_t meshes = 0;
+    for (int frame = 0; frame < framesPerPhase; frame++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        planet->UpdatePhysics(0);
+        planet->Draw();
+        if (planet->GetUploadSize() > 0)
+        {
+            lastMesh = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - jump).count();
+            if (firstMesh < 0) firstMesh = lastMesh;
+            meshes++;
+        }
+        std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<long long>(frameTime * 1000)));
+    }
+    std::fprintf(out, "  \"teleport\": {\"first_mesh_ms\": %.3f, \"last_mesh_ms\": %.3f, \"meshes\": %zu, \"triangles\": %zu},\n", firstMesh, lastMesh, meshes, planet->GetTriangleCount());
+    readerDone = true;
+    reader.join();
+    std::fprintf(out, "  \"surface_queries\": {\"count\": %zu, \"min_radius\": %.6f, \"max_radius\": %.6f, \"implausible\": %zu}\n}\n", surfaceQueries, lowestSurface, highestSurface, implausibleSurfaces);
+    std::fclose(out);
+    if (implausibleSurfaces > 0)
+    {
+        std::fprintf(stderr, "%zu surface queries returned an implausible radius\n", implausibleSurfaces);
+        return 1;
+    }
+    return 0;
+}
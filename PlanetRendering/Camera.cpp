@@ -2,10 +2,11 @@
 
 Camera::Camera(int windowWidth, int windowHeight) : 
 	position(10.1f, 10.0f, 0.0f),
-	aspectRatio(((float)windowWidth)/(float)windowHeight),
-	FieldOfView(60), XRotation(0.0f), ZRotation(90.0f), YRotation(0.0f),PlanetRotation(0.0),
+	XRotation(0.0f), ZRotation(90.0f), YRotation(0.0f),PlanetRotation(0.0), FieldOfView(60),
+ViewportHeight(windowHeight),
 NEAR_PLANE(0),//std::numeric_limits<float>::epsilon()),
-FAR_PLANE(2000.0f)
+FAR_PLANE(2000.0f),
+	aspectRatio(((float)windowWidth)/(float)windowHeight)
 {
 }
 
@@ -19,6 +20,7 @@ vmat4 Camera::GetViewMatrix()
 void Camera::ResizedWindow(int windowWidth, int windowHeight)
 {
 	//aspectRatio = ((float)windowWidth)/((float)windowHeight);
+    ViewportHeight = windowHeight;
 }
 
 vmat4 Camera::GetProjectionMatrix()
@@ -31,8 +31,10 @@ public:
     vfloat PlanetRotation;
     //FOV represents the angle the bounds of the camera's view subdtends in the scene
 	vfloat FieldOfView;
-    //Currently does nothing
+    //Only updates ViewportHeight (the aspect ratio stays fixed)
     void ResizedWindow(int windowWidth, int windowHeight);
+    //height of the window in pixels, used to convert sizes in the scene to sizes on screen
+    int ViewportHeight;
     //near clipping plane - all geometry CLOSER to camera than this value is invisible
     //It is possible to set this to 0 (allowing theoretically infinite zoom), but it causes problems with the depth buffer (polygons are not sorted properly on screen)
     //If I add a logarithmic depth buffer (which is ideal for large expanses where drawn geometry vary many orders of magnitude insize), the limits on this value may increase
@@ -0,0 +1,53 @@
+//
+//  EpochManager.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+
+#include "EpochManager.h"
+#include <algorithm>
+#include <thread>
+
+EpochManager::EpochManager() : epoch(1)
+{
+    for (std::atomic<std::uint64_t>& reader : readers) reader.store(0);
+}
+
+unsigned int EpochManager::enter()
+{
+    while (true)
+    {
+        for (unsigned int slot = 0; slot<MAX_READERS; slot++)
+        {
+            std::uint64_t current = epoch.load();
+            std::uint64_t expected = 0;
+            if (!readers[slot].compare_exchange_strong(expected, current)) continue;
+            //Advance() may have looked at the slot before the claim was visible; the epoch it started then is only safe to enter once announced
+            for (std::uint64_t now = epoch.load(); now!=current; now = epoch.load())
+            {
+                current = now;
+                readers[slot].store(current);
+            }
+            return slot;
+        }
+        std::this_thread::yield();
+    }
+}
+
+void EpochManager::exit(unsigned int slot)
+{
+    readers[slot].store(0);
+}
+
+std::uint64_t EpochManager::Advance()
+{
+    //readers entering from here on cannot reach anything unlinked before this point
+    std::uint64_t oldest = epoch.fetch_add(1) + 1;
+    for (const std::atomic<std::uint64_t>& reader : readers)
+    {
+        std::uint64_t entered = reader.load();
+        if (entered!=0) oldest = std::min(oldest, entered);
+    }
+    return oldest;
+}
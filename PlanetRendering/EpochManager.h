@@ -0,0 +1,74 @@
+//
+//  EpochManager.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+///Epoch-based reclamation for structures with a single writer and any number of readers on other threads.
+///A reader holds a Guard while it walks the structure.  The writer unlinks memory, retires it with the current epoch (see RetireList), and calls Advance() now and then:
+///whatever was retired before the epoch Advance() returns can no longer be reached by any reader and may be freed.
+///Entering and leaving an epoch takes no lock, and the writer never waits for a reader; memory a slow reader might still see simply stays retired a little longer.
+class EpochManager
+{
+public:
+    ///readers that may hold a guard at once; a reader finding every slot taken waits for one to be released
+    static const unsigned int MAX_READERS = 64;
+
+    EpochManager();
+
+    ///Keeps everything reachable when it was made from being freed until it is destroyed
+    class Guard
+    {
+    public:
+        explicit Guard(EpochManager& manager) : manager(manager), slot(manager.enter()) {}
+        ~Guard() { manager.exit(slot); }
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+        EpochManager& manager;
+        unsigned int slot;
+    };
+
+    ///Epoch to retire memory unlinked now in (writer only)
+    inline std::uint64_t Current() const { return epoch.load(); }
+    ///Starts a new epoch and returns the oldest epoch a reader may still be in: memory retired in an earlier epoch can be freed (writer only)
+    std::uint64_t Advance();
+private:
+    EpochManager(const EpochManager&);
+    EpochManager& operator=(const EpochManager&);
+
+    unsigned int enter();
+    void exit(unsigned int slot);
+
+    std::atomic<std::uint64_t> epoch;
+    ///epoch each reader entered in, 0 for a free slot (epochs start at 1)
+    std::array<std::atomic<std::uint64_t>, MAX_READERS> readers;
+};
+
+///Memory retired by the writer of an EpochManager, kept in the order it was retired until no reader can reach it
+template<typename T>
+class RetireList
+{
+public:
+    void Retire(const T& item, std::uint64_t epoch) { items.push_back(std::make_pair(epoch, item)); }
+    ///Frees (by calling release on it) everything retired before epoch safe, as returned by EpochManager::Advance()
+    template<typename F>
+    void Reclaim(std::uint64_t safe, F release)
+    {
+        while (!items.empty() && items.front().first < safe)
+        {
+            release(items.front().second);
+            items.pop_front();
+        }
+    }
+    std::size_t Size() const { return items.size(); }
+private:
+    std::deque<std::pair<std::uint64_t, T>> items;
+};
@@ -0,0 +1,110 @@
+//
+//  Face.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include "glm/glm.hpp"
+#include "typedefs.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include "SlabPool.h"
+
+typedef std::uint32_t FaceIndex;
+typedef std::uint32_t VertexIndex;
+typedef std::uint32_t PatchIndex;
+const FaceIndex NULL_FACE = 0xFFFFFFFFu;
+const VertexIndex NULL_VERTEX = 0xFFFFFFFFu;
+const PatchIndex NULL_PATCH = 0xFFFFFFFFu;
+
+///Stable name of a face in the subdivision, independent of where the face happens to be stored.
+///A base face has ROOT_ADDRESS | (its index among the 20), and child i of a face has (address << 2) | i, so the bits spell out the root and the path down to the face.
+///The leading ROOT_ADDRESS bit keeps faces of different levels apart; 64 bits hold paths deeper than MAX_LOD.
+///Faces do not store it (see Planet::addressOf): it is only needed when a face is split.
+typedef std::uint64_t SubdivisionAddress;
+const SubdivisionAddress ROOT_ADDRESS = 0x20;
+
+///Vertex of the face tree.  Faces reference these by index instead of embedding them, so a vertex is stored once no matter how many faces share it.
+struct TerrainVertex
+{
+    vvec3 position;
+    ///number of splits using this vertex as an edge midpoint (see VertexPool)
+    unsigned int refCount;
+    ///sum of the normals of the leaf faces using this vertex; kept up to date by every split and combination so that extraction only has to normalize it
+    vvec3 normal;
+    ///noise value the vertex was displaced by, if it is an edge midpoint; kept so that combining its faces can hand it to the HeightCache
+    float noise;
+    
+    TerrainVertex() : refCount(0), normal(0), noise(0) {}
+    explicit TerrainVertex(vvec3 _position) : position(_position), refCount(0), normal(0), noise(0) {}
+};
+
+///Representation of a triangular face on CPU side of program,
+///represents a single node in the face tree
+///Nodes live in the planet's FacePool and refer to each other (and to their vertices) by 32-bit index, which keeps them small enough for several to share a cache line.
+struct Face
+{
+    ///vertices of triangle (indices into the planet's VertexPool)
+    std::array<VertexIndex, 3> vertices;
+    
+    ///index of the first child in tree structure (NULL_FACE for a leaf)
+    ///the four children are always allocated together as one FacePool block, so child i is children+i
+    ///Readers on other threads (see Planet::GetSurfaceRadius) descend the tree while the update thread splits and combines faces, so the index is atomic:
+    ///a split stores it with release order once the children are filled in, and those readers load it with acquire order (FirstChild).
+    ///The update thread and the tasks it waits for are ordered by the task pool, so IsLeaf() and Child() load it relaxed.
+    std::atomic<FaceIndex> children;
+    
+    FaceIndex parent;
+    
+    ///depth in tree
+    unsigned short level;
+    ///only used on patch roots: set when a face of the patch was split or combined since the patch was last extracted
+    bool dirty;
+    
+    ///slot in the planet's patch table if this face is the root of a mesh patch (see Planet::PATCH_DEPTH), NULL_PATCH otherwise
+    PatchIndex patch;
+    ///estimated geometric error of the face: how far (in object space) the surface its split would produce can stray from the flat triangle (see LODMetric)
+    float error;
+    ///unit normal of the flat triangle, computed once when the face is made (single precision whatever vfloat is, to keep the node small)
+    glm::vec3 normal;
+    ///bounding sphere of everything below the face, including faces not split yet (see Planet::computeBounds)
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+    ///cosine of the half-angle of a cone around normal containing the normals of the leaves below the face; it widens as the subtree is split, and is not narrowed again when it is combined
+    float coneCos;
+    
+    inline FaceIndex FirstChild(std::memory_order order = std::memory_order_relaxed) const { return children.load(order); }
+    inline bool IsLeaf() const { return FirstChild()==NULL_FACE; }
+    inline FaceIndex Child(int i) const { return FirstChild() + i; }
+    
+    Face() : vertices{NULL_VERTEX,NULL_VERTEX,NULL_VERTEX}, children(NULL_FACE), parent(NULL_FACE), level(0), dirty(false), patch(NULL_PATCH), error(0), normal(0), boundsCenter(0), boundsRadius(0), coneCos(1) {}
+    
+    Face(FaceIndex _parent, VertexIndex _v1, VertexIndex _v2, VertexIndex _v3, unsigned int _level) : vertices{_v1,_v2,_v3}, children(NULL_FACE), parent(_parent), level(static_cast<unsigned short>(_level)), dirty(false), patch(NULL_PATCH), error(0), normal(0), boundsCenter(0), boundsRadius(0), coneCos(1)
+    {
+        
+    }
+    
+    //Faces are only copied into pool slots that no reader can see yet (see Planet::subdivideFace), so the children index is copied relaxed.
+    Face(const Face& other) : vertices(other.vertices), children(other.FirstChild()), parent(other.parent), level(other.level), dirty(other.dirty), patch(other.patch), error(other.error), normal(other.normal), boundsCenter(other.boundsCenter), boundsRadius(other.boundsRadius), coneCos(other.coneCos) {}
+    Face& operator=(const Face& other)
+    {
+        vertices = other.vertices;
+        children.store(other.FirstChild(), std::memory_order_relaxed);
+        parent = other.parent;
+        level = other.level;
+        dirty = other.dirty;
+        patch = other.patch;
+        error = other.error;
+        normal = other.normal;
+        boundsCenter = other.boundsCenter;
+        boundsRadius = other.boundsRadius;
+        coneCos = other.coneCos;
+        return *this;
+    }
+};
+
+static_assert(sizeof(Face)<=64, "Face nodes should stay within a cache line");
+
+typedef SlabPool<Face, 4> FacePool;
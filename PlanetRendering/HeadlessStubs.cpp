@@ -0,0 +1,84 @@
+//
+//  HeadlessStubs.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+//  Stand-ins for the OpenGL and SDL functions (and the MainGame_SDL/ResourcePath symbols) used by the terrain code, so the benchmark runs without a window or a GPU.
+//  Buffer and shader calls do nothing; object names are handed out from a counter so that the callers see distinct, non-zero objects.
+//
+
+#include <OpenGL/gl3.h>
+#include <SDL2/SDL.h>
+#include <string>
+#include "MainGame_SDL.h"
+#include "ResourcePath.hpp"
+
+vfloat MainGame_SDL::ElapsedMilliseconds = 0.0f;
+
+//output files (such as the planets' performance logs) go to the working directory
+std::string resourcePath()
+{
+    return "";
+}
+
+namespace
+{
+    Uint8 keyboardState[SDL_NUM_SCANCODES];
+    GLuint nextName = 1;
+}
+
+extern "C"
+{
+const Uint8* SDL_GetKeyboardState(int* numkeys)
+{
+    if (numkeys) *numkeys = SDL_NUM_SCANCODES;
+    return keyboardState;
+}
+Uint32 SDL_GetRelativeMouseState(int* x, int* y)
+{
+    if (x) *x = 0;
+    if (y) *y = 0;
+    return 0;
+}
+
+void glAttachShader(GLuint, GLuint) {}
+void glBindBuffer(GLenum, GLuint) {}
+void glBindBufferBase(GLenum, GLuint, GLuint) {}
+void glBindVertexArray(GLuint) {}
+void glBufferData(GLenum, GLsizeiptr, const void*, GLenum) {}
+void glBufferSubData(GLenum, GLintptr, GLsizeiptr, const void*) {}
+void glCompileShader(GLuint) {}
+GLuint glCreateProgram() { return nextName++; }
+GLuint glCreateShader(GLenum) { return nextName++; }
+void glCullFace(GLenum) {}
+void glDeleteShader(GLuint) {}
+void glDeleteVertexArrays(GLsizei, const GLuint*) {}
+void glDeleteBuffers(GLsizei, const GLuint*) {}
+void glDepthFunc(GLenum) {}
+void glDepthRange(GLdouble, GLdouble) {}
+void glDrawElements(GLenum, GLsizei, GLenum, const void*) {}
+void glMultiDrawElementsBaseVertex(GLenum, const GLsizei*, GLenum, const void* const*, GLsizei, const GLint*) {}
+void glEnable(GLenum) {}
+void glDisable(GLenum) {}
+void glEnableVertexAttribArray(GLuint) {}
+void glGenBuffers(GLsizei n, GLuint* b) { for (GLsizei i = 0; i<n; i++) b[i] = nextName++; }
+void glGenVertexArrays(GLsizei n, GLuint* b) { for (GLsizei i = 0; i<n; i++) b[i] = nextName++; }
+void glGetProgramInfoLog(GLuint, GLsizei, GLsizei*, GLchar* s) { if (s) s[0] = 0; }
+void glGetProgramiv(GLuint, GLenum, GLint* p) { *p = 1; }
+void glGetShaderInfoLog(GLuint, GLsizei, GLsizei*, GLchar* s) { if (s) s[0] = 0; }
+void glGetShaderiv(GLuint, GLenum, GLint* p) { *p = 1; }
+GLuint glGetUniformBlockIndex(GLuint, const GLchar*) { return 0; }
+GLint glGetUniformLocation(GLuint, const GLchar*) { return 0; }
+void glLinkProgram(GLuint) {}
+void glPolygonMode(GLenum, GLenum) {}
+void glShaderSource(GLuint, GLsizei, const GLchar* const*, const GLint*) {}
+void glUniform1f(GLint, GLfloat) {}
+void glUniform1i(GLint, GLint) {}
+void glUniform3fv(GLint, GLsizei, const GLfloat*) {}
+void glUniformMatrix4fv(GLint, GLsizei, GLboolean, const GLfloat*) {}
+void glUniformBlockBinding(GLuint, GLuint, GLuint) {}
+void glUseProgram(GLuint) {}
+void glVertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) {}
+void glVertexAttribLPointer(GLuint, GLint, GLenum, GLsizei, const void*) {}
+}
@@ -0,0 +1,90 @@
+//
+//  HeightCache.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+
+#include "HeightCache.h"
+
+HeightCache::HeightCache(std::size_t _capacity) : capacity(0), hits(0), misses(0)
+{
+    SetCapacity(_capacity);
+}
+
+bool HeightCache::Find(SubdivisionAddress address, Value& value)
+{
+    if (capacity==0) return false;
+    Shard& shard = shardOf(address);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(address);
+    if (it==shard.index.end())
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    value = it->second->second;
+    return true;
+}
+
+void HeightCache::Insert(SubdivisionAddress address, const Value& value)
+{
+    if (capacity==0) return;
+    Shard& shard = shardOf(address);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(address);
+    if (it!=shard.index.end())
+    {
+        it->second->second = value;
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return;
+    }
+    if (shard.entries.size() < shard.capacity)
+        shard.entries.push_front(Entry(address, value));
+    else
+    {
+        //the least recently used entry is reused for the new face, so a full cache does not allocate
+        shard.index.erase(shard.entries.back().first);
+        shard.entries.splice(shard.entries.begin(), shard.entries, std::prev(shard.entries.end()));
+        shard.entries.front() = Entry(address, value);
+    }
+    shard.index[address] = shard.entries.begin();
+}
+
+void HeightCache::SetCapacity(std::size_t _capacity)
+{
+    capacity = _capacity;
+    for (Shard& shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.capacity = (_capacity + SHARD_COUNT - 1) / SHARD_COUNT;
+        while (shard.entries.size() > shard.capacity)
+        {
+            shard.index.erase(shard.entries.back().first);
+            shard.entries.pop_back();
+        }
+    }
+}
+
+HeightCache::Stats HeightCache::GetStats()
+{
+    Stats stats;
+    stats.Hits = hits;
+    stats.Misses = misses;
+    stats.Entries = 0;
+    stats.Capacity = capacity;
+    stats.BytesUsed = 0;
+    for (Shard& shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::size_t entries = shard.entries.size();
+        stats.Entries += entries;
+        //a list node holds the entry and two links; a map node holds the key, the list position and a link; plus the bucket array
+        stats.BytesUsed += entries * (sizeof(Entry) + 2 * sizeof(void*)) +
+            entries * (sizeof(std::pair<const SubdivisionAddress, std::list<Entry>::iterator>) + sizeof(void*)) +
+            shard.index.bucket_count() * sizeof(void*);
+    }
+    return stats;
+}
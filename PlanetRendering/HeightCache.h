@@ -0,0 +1,74 @@
+//
+//  HeightCache.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include "Face.h"
+#include <array>
+#include <atomic>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+///Bounded least-recently-used cache of the terrain noise sampled for the edge midpoints of a face, keyed by the face's SubdivisionAddress.
+///Combining a face throws its midpoints away, and their noise is stored here then; when the camera moves back and the face is split again, its noise comes from here instead of being evaluated again.
+///Faces that are still split are not stored, so the whole capacity goes to faces a later split may ask for.
+///Like VertexPool, the cache is split into shards with their own locks (and their own share of the capacity), since faces are split on several threads at once.
+class HeightCache
+{
+public:
+    ///noise of a face's three edge midpoints, in the order (0,1), (0,2), (1,2)
+    typedef std::array<float, 3> Value;
+
+    struct Stats
+    {
+        std::size_t Hits;
+        std::size_t Misses;
+        std::size_t Entries;
+        std::size_t Capacity;
+        ///estimated memory held by the entries and their index
+        std::size_t BytesUsed;
+        inline double HitRate() const { return Hits + Misses==0 ? 0.0 : static_cast<double>(Hits) / (Hits + Misses); }
+    };
+
+    ///capacity is the number of faces kept; 0 disables the cache
+    explicit HeightCache(std::size_t capacity);
+
+    ///Looks up the noise of a face (marking it as recently used).  Returns false on a miss.
+    bool Find(SubdivisionAddress address, Value& value);
+    ///Stores the noise of a face, evicting the least recently used face of its shard when that is full
+    void Insert(SubdivisionAddress address, const Value& value);
+    ///Changes the capacity, evicting faces if it shrinks
+    void SetCapacity(std::size_t capacity);
+    inline std::size_t GetCapacity() const { return capacity.load(); }
+
+    Stats GetStats();
+private:
+    HeightCache(const HeightCache&);
+    HeightCache& operator=(const HeightCache&);
+
+    static const unsigned int SHARD_COUNT = 16;
+    typedef std::pair<SubdivisionAddress, Value> Entry;
+    struct Shard
+    {
+        ///most recently used first
+        std::list<Entry> entries;
+        std::unordered_map<SubdivisionAddress, std::list<Entry>::iterator> index;
+        std::size_t capacity;
+        std::mutex mutex;
+        Shard() : capacity(0) {}
+    };
+    inline Shard& shardOf(SubdivisionAddress address)
+    {
+        //the low bits of an address are the last steps of its path, so siblings are spread over the shards
+        return shards[(address * 0x9E3779B97F4A7C15ull) >> 60];
+    }
+
+    std::array<Shard, SHARD_COUNT> shards;
+    std::atomic<std::size_t> capacity;
+    std::atomic<std::size_t> hits;
+    std::atomic<std::size_t> misses;
+};
@@ -0,0 +1,26 @@
+//
+//  LODMetric.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+
+#include "LODMetric.h"
+#include <cmath>
+
+vfloat DistanceLODMetric::Priority(vfloat distance, unsigned int level, vfloat /*error*/) const
+{
+    return static_cast<vfloat>(1 << LODMultiplier) / static_cast<vfloat>(1 << level) / distance;
+}
+
+void ScreenSpaceErrorMetric::BeginPass(const Camera& camera)
+{
+    //the field of view is in degrees (see Camera::GetProjectionMatrix) and spans the height of the viewport
+    vfloat halfAngle = static_cast<vfloat>(0.5) * camera.FieldOfView * static_cast<vfloat>(M_PI / 180.0);
+    pixelsPerUnit = static_cast<vfloat>(camera.ViewportHeight) / (2 * std::tan(halfAngle));
+}
+
+vfloat ScreenSpaceErrorMetric::Priority(vfloat distance, unsigned int /*level*/, vfloat error) const
+{
+    return error * pixelsPerUnit / (distance * Tolerance);
+}
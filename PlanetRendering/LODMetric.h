@@ -0,0 +1,46 @@
+//
+//  LODMetric.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include "Camera.h"
+
+///Decides how badly a face needs to be split.  Planet asks for a face's priority at the distance of its farthest vertex (to split it) and of its nearest vertex (to merge its children):
+///a leaf is split while its priority exceeds 1, and children are merged once their parent's priority drops to Planet::MERGE_PRIORITY.
+///BeginPass() is called on the update thread before each LOD pass; Priority() is then called from several threads at once, so it must not change the metric.
+///A metric belongs to a single planet.
+class LODMetric
+{
+public:
+    virtual ~LODMetric() {}
+    ///Takes whatever the metric needs from the camera for the coming pass
+    virtual void BeginPass(const Camera& /*camera*/) {}
+    ///Priority of a face of the given level, whose geometric error is error (see Face::error), seen from distance
+    virtual vfloat Priority(vfloat distance, unsigned int level, vfloat error) const = 0;
+};
+
+///The original metric: a face is split within a fixed distance of 2^LODMultiplier / 2^level, whatever the terrain or the camera's projection.
+class DistanceLODMetric : public LODMetric
+{
+public:
+    explicit DistanceLODMetric(int lodMultiplier) : LODMultiplier(lodMultiplier) {}
+    int LODMultiplier;
+    vfloat Priority(vfloat distance, unsigned int level, vfloat error) const override;
+};
+
+///Projects a face's geometric error onto the screen and splits the face while that exceeds Tolerance pixels.
+///Faces whose split changes little (smooth or flat terrain, far away or outside a narrow field of view) stay coarse, and rough terrain close to the camera gets the triangles instead.
+class ScreenSpaceErrorMetric : public LODMetric
+{
+public:
+    ScreenSpaceErrorMetric() : Tolerance(1.0), pixelsPerUnit(1) {}
+    ///largest error in pixels that is left unsplit
+    vfloat Tolerance;
+    void BeginPass(const Camera& camera) override;
+    vfloat Priority(vfloat distance, unsigned int level, vfloat error) const override;
+private:
+    ///pixels covered by a length of 1 at a distance of 1 (perpendicular to the view)
+    vfloat pixelsPerUnit;
+};
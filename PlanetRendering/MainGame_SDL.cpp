@@ -161,6 +161,9 @@ void MainGame_SDL::HandleEvents(SolarSystem& solarSystem, Player& player)
                 case SDL_SCANCODE_V:
                     solarSystem.NextRenderMode();
                     break;
+                case SDL_SCANCODE_O:
+                    solarSystem.ToggleOceanMode();
+                    break;
 //                case SDL_SCANCODE_TAB:
 //                if (planet.CurrentRenderMode==Planet::RenderMode::SOLID) planet.CurrentRenderMode=Planet::RenderMode::WIRE;
 //                else planet.CurrentRenderMode=Planet::RenderMode::SOLID;
@@ -0,0 +1,112 @@
+//
+//  OceanShell.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+
+#include "OceanShell.h"
+#include "Planet.h"
+#include <map>
+#include <utility>
+
+OceanShell::OceanShell(unsigned int _subdivisions) : subdivisions(_subdivisions), VAO(0), VBO(0), IBO(0), built(false), builtRadius(0), triangleCount(0)
+{
+}
+
+OceanShell::~OceanShell()
+{
+    if (!built) return;
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &IBO);
+}
+
+void OceanShell::SetBaseMesh(const std::vector<vvec3>& triangles)
+{
+    baseTriangles = triangles;
+    //no radius is negative, so the next Draw() rebuilds the shell
+    builtRadius = -1;
+}
+
+void OceanShell::Draw(vfloat radius)
+{
+    if (baseTriangles.empty()) return;
+    if (!built || builtRadius!=radius) build(radius);
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, (GLsizei)(3 * triangleCount), GL_UNSIGNED_INT, (void*)0);
+    glBindVertexArray(0);
+}
+
+void OceanShell::build(vfloat radius)
+{
+    //the corners of the base mesh are merged by position, and every edge midpoint is made once
+    std::vector<vvec3> directions;
+    std::vector<unsigned int> indices;
+    {
+        std::map<std::pair<vfloat, std::pair<vfloat, vfloat>>, unsigned int> corners;
+        for (const vvec3& corner : baseTriangles)
+        {
+            vvec3 d = glm::normalize(corner);
+            auto inserted = corners.insert(std::make_pair(std::make_pair(d.x, std::make_pair(d.y, d.z)), (unsigned int)directions.size()));
+            if (inserted.second) directions.push_back(d);
+            indices.push_back(inserted.first->second);
+        }
+    }
+    for (unsigned int level = 0; level<subdivisions; level++)
+    {
+        std::map<std::pair<unsigned int, unsigned int>, unsigned int> midpoints;
+        auto midpoint = [&](unsigned int a, unsigned int b)
+        {
+            auto inserted = midpoints.insert(std::make_pair(std::make_pair(std::min(a, b), std::max(a, b)), (unsigned int)directions.size()));
+            if (inserted.second) directions.push_back(glm::normalize(directions[a] + directions[b]));
+            return inserted.first->second;
+        };
+        std::vector<unsigned int> next;
+        next.reserve(indices.size() * 4);
+        for (std::size_t i = 0; i<indices.size(); i+=3)
+        {
+            unsigned int a = indices[i], b = indices[i+1], c = indices[i+2];
+            unsigned int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            //the same winding as the face being split
+            unsigned int children[12] = {a, ab, ca,  ab, b, bc,  ca, bc, c,  ab, bc, ca};
+            next.insert(next.end(), children, children + 12);
+        }
+        indices.swap(next);
+    }
+
+    std::vector<Vertex> vertices;
+    vertices.reserve(directions.size());
+    for (const vvec3& d : directions)
+    {
+        vvec3 position = d * radius;
+        vertices.push_back(Vertex(position, d));
+    }
+
+    if (!built)
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &IBO);
+    }
+    //the same vertex layout as the terrain (see Planet::generateBuffers), so the same shader draws both
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(2);
+#ifdef VERTEX_DOUBLE
+    glVertexAttribLPointer(0, 3, GL_DOUBLE, sizeof(Vertex), (void*)__offsetof(Vertex, x));
+    glVertexAttribLPointer(2, 3, GL_DOUBLE, sizeof(Vertex), (void*)__offsetof(Vertex, nx));
+#else
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),(void*)__offsetof(Vertex, x));
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),(void*)__offsetof(Vertex, nx));
+#endif
+    glBindVertexArray(0);
+
+    triangleCount = indices.size() / 3;
+    builtRadius = radius;
+    built = true;
+}
@@ -0,0 +1,39 @@
+//
+//  OceanShell.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include <OpenGL/gl3.h>
+#include "glm/glm.hpp"
+#include "typedefs.h"
+#include <vector>
+
+///Sphere at sea level, drawn in place of the water in Planet's ocean mode (see Planet::OceanMode).
+///It is a subdivided icosahedron of fixed resolution, built once on the render thread and drawn with the terrain shader (as flat water: every vertex is exactly at sea level).
+///Between its vertices the shell sags below the sphere by about radius * (edge angle)^2 / 8, so finer subdivisions give more accurate coastlines at the price of more triangles.
+class OceanShell
+{
+public:
+    explicit OceanShell(unsigned int subdivisions);
+    ~OceanShell();
+
+    ///Faces to subdivide, three corners each (on any sphere around the origin, wound like the terrain)
+    void SetBaseMesh(const std::vector<vvec3>& triangles);
+    ///Draws the shell at radius with the bound shader program (building it first if the radius changed).
+    void Draw(vfloat radius);
+    std::size_t GetTriangleCount() const { return triangleCount; }
+private:
+    OceanShell(const OceanShell&);
+    OceanShell& operator=(const OceanShell&);
+
+    void build(vfloat radius);
+
+    const unsigned int subdivisions;
+    std::vector<vvec3> baseTriangles;
+    GLuint VAO, VBO, IBO;
+    bool built;
+    vfloat builtRadius;
+    std::size_t triangleCount;
+};
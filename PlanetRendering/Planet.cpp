@@ -18,22 +18,14 @@
 #include "RandomUtils.h"
 #include<fstream>
 #include "ResourcePath.hpp"
-#include "AABB.h"
 #include "glm/vec3.hpp"
+#include <queue>
+#include <limits>
 
 //Constructor for planet.  Initializes VBO (experimental) and builds the base icosahedron mesh.
-Planet::Planet(int planetIndex, glm::vec3 pos, vfloat radius, double mass, vfloat seed, Player& _player, GLManager& _glManager, float terrainRegularity)
+Planet::Planet(int planetIndex, glm::vec3 pos, vfloat radius, double mass, vfloat seed, Player& _player, GLManager& _glManager, TaskPool& _taskPool, float terrainRegularity)
 :
-performanceOutput("planet" + std::to_string(planetIndex) + ".csv"),
-Radius(radius),
-time(0),
-SEED(seed),
-CurrentRenderMode(RenderMode::SOLID),
-player(_player),
-glManager(_glManager),
-closed(false),
-CurrentRotationMode(RotationMode::NO_ROTATION),
-atmosphere(pos, radius*1.01),
+PhysicsObject(static_cast<glm::dvec3>(pos), mass),
 PlanetInfo{
 //    glm::vec4(0.0945,0.2011,0.45,1.),
 //    glm::vec4(0.0867,0.3336,0.51,1.),
@@ -50,13 +42,56 @@ PlanetInfo{
     0.001f,
     0.005f,
     1.0f},
-PhysicsObject(static_cast<glm::dvec3>(pos), mass),
+CurrentRenderMode(RenderMode::SOLID),
+Radius(radius),
 TERRAIN_REGULARITY(terrainRegularity),
+CurrentRotationMode(RotationMode::NO_ROTATION),
+AngularVelocity(100.,0.0,0),
 Angle(0),
-AngularVelocity(100.,0.0,0)
+SEED(seed),
+RecordTimings(false),
+OceanMode(false),
+updateRequested(true),
+refinementPending(false),
+cancellable(false),
+performanceOutput("planet" + std::to_string(planetIndex) + ".csv"),
+meshGeneration(0),
+uploadedGeneration(0),
+vertexBufferSize(0),
+indexBufferSize(0),
+uploadSize(0),
+glManager(_glManager),
+player(_player),
+taskPool(_taskPool),
+atmosphere(pos, radius*1.01),
+lodMetric(std::make_shared<ScreenSpaceErrorMetric>()),
+oceanMode(false),
+publishedOcean(false),
+ocean(OCEAN_SUBDIVISIONS),
+cullDistance(0),
+lastHorizonDist(0),
+speculating(false),
+updateLatency(0),
+//the noise hashes integers, so the seed's fractional part is kept in the low bits
+noise(static_cast<std::uint32_t>(static_cast<std::int32_t>(std::floor(seed * 65536.0)))),
+heightCache(0),
+tileCacheMaxBytes(0),
+time(0),
+closed(false),
+updateCancelled(false),
+triangleCount(0),
+flatLeafCount(0),
+submergedLeafCount(0),
+framesDrawn(0),
+framesEvaluated(0),
+insufficientFrames(0),
+insufficientLeafFrames(0)
 //5.972E24)
 {
-    lastPlayerUpdatePosition=player.Position;
+    lastPlayerUpdatePosition=player.Position - Position;
+    lastUpdateAngle=Angle;
+    cameraSnapshot=GetPlayerDisplacement();
+    snapshotTime=std::chrono::high_resolution_clock::now();
     std::ofstream stream(resourcePath() + performanceOutput, std::ios::out);
     generateBuffers();
     buildBaseMesh();
@@ -69,169 +104,563 @@ AngularVelocity(100.,0.0,0)
 //clear allocated memory and OpenGL objects
 Planet::~Planet()
 {
-    closed = true;
-    glDeleteVertexArrays(1, &VAO);
-    for (auto it = faces.begin(); it!=faces.end();)
     {
-        it = faces.erase(it);
+        std::lock_guard<std::mutex> lock(updateMutex);
+        closed = true;
     }
+    updateCondition.notify_all();
+    //wait for the update thread before the face tree (and the pool backing it) goes away
     updateThread.join();
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &IBO);
+    faces.clear();
 }
 
-inline vfloat pointLineDist(vvec2 point1, vvec2 point2, vvec2 point);
-bool Planet::faceInView(const Face& f)
+void Planet::subdivideFace(FaceIndex index)
 {
+    Face& iterator = facePool[index];
+    if (!iterator.IsLeaf()) return;
     
-    std::array<vvec2,3> transformedVertices;
+    //face vertices
+    std::array<vvec3, 3> v;
     for (int i = 0; i<3;i++)
+        v[i]=vertexPosition(iterator.vertices[i]);
+    
+    //height scale of terrain
+    vfloat fac = heightScale(iterator.level);
+    
+    //The noise of all three edge midpoints (in the order 12, 13, 23) is evaluated in one batch, before knowing which of them already exist:
+    //a SIMD batch of three costs about as much as a single scalar evaluation.
+    //Each level is one octave: its frequency doubles with the density of the faces, and coordinates are wrapped (in double precision) to the noise's period.
+    //A face that was split before (and combined since) finds its noise in the height cache instead.
+    const int edges[3][2] = {{0,1},{0,2},{1,2}};
+    std::array<vvec3, 3> directions;
+    for (int i = 0; i<3; i++)
+        directions[i] = glm::normalize(glm::normalize(v[edges[i][0]]) + glm::normalize(v[edges[i][1]]));
+    HeightCache::Value noiseValues;
+    SubdivisionAddress address = addressOf(index);
+    if (!heightCache.Find(address, noiseValues) && !tileCache.Find(address, noiseValues))
+    {
+        float nx[3], ny[3], nz[3];
+        double frequency = std::ldexp(1.0, static_cast<int>(iterator.level));
+        for (int i = 0; i<3; i++)
+        {
+            glm::dvec3 p = glm::dvec3(directions[i]) * frequency;
+            p -= glm::floor(p / static_cast<double>(TerrainNoise::PERIOD)) * static_cast<double>(TerrainNoise::PERIOD);
+            nx[i] = static_cast<float>(p.x);
+            ny[i] = static_cast<float>(p.y);
+            nz[i] = static_cast<float>(p.z);
+        }
+        noise.GradientBatch(nx, ny, nz, noiseValues.data(), 3, iterator.level);
+        tileCache.Insert(address, noiseValues);
+    }
+    
+    //midpoints are shared with the face across each edge, so they are only generated by whichever of the two splits first
+    const std::array<VertexIndex, 3>& iv = iterator.vertices;
+    VertexIndex i12 = vertexPool.AcquireMidpoint(iv[0], iv[1], [&]() { return generateMidpoint(v[0], v[1], directions[0], noiseValues[0], fac); });
+    VertexIndex i13 = vertexPool.AcquireMidpoint(iv[0], iv[2], [&]() { return generateMidpoint(v[0], v[2], directions[1], noiseValues[1], fac); });
+    VertexIndex i23 = vertexPool.AcquireMidpoint(iv[1], iv[2], [&]() { return generateMidpoint(v[1], v[2], directions[2], noiseValues[2], fac); });
+    
+    //the four children share a single pool block
+    FaceIndex block = facePool.AllocateBlock();
+    unsigned int level = iterator.level+1;
+    facePool[block + 0] = Face(index,i13,i12,i23,level);
+    facePool[block + 1] = Face(index,iterator.vertices[2],i13,i23,level);
+    facePool[block + 2] = Face(index,i23,i12,iterator.vertices[1],level);
+    facePool[block + 3] = Face(index,i13,iterator.vertices[0],i12,level);
+    
+    //The children's error is predicted from how far this split moved the midpoints off the edges, scaled down to the next level's height scale.
+    //It is not allowed to fall faster than that of the parent, so that a few midpoints where the noise happens to be near 0 do not stop refinement below them.
+    vfloat displacement = std::max(std::max(glm::length(vertexPosition(i12) - (v[0] + v[1]) * static_cast<vfloat>(0.5)),
+                                            glm::length(vertexPosition(i13) - (v[0] + v[2]) * static_cast<vfloat>(0.5))),
+                                   glm::length(vertexPosition(i23) - (v[1] + v[2]) * static_cast<vfloat>(0.5)));
+    vfloat childError = std::max(displacement, static_cast<vfloat>(0.5) * iterator.error) * heightScale(level) / fac;
+    for (int i = 0; i<4; i++)
     {
-        vvec4 v = PlanetInfo.transformMatrix * vvec4(f.vertices[i],1.0);
-        transformedVertices[i]=vvec2(v.x/v.w,v.y/v.w);
+        Face& child = facePool[block + i];
+        child.error = static_cast<float>(childError);
+        //computed here, in parallel, so that the (serial) normal bookkeeping after the split and the extraction only read it
+        child.normal = glm::vec3(faceNormal(child));
+        computeBounds(child);
     }
     
-    return AABB::Intersection(AABB(0,0,2,2),AABB(transformedVertices));
-//    for (vvec2 vert:v)
-//    {
-//        if (pointLineDist(transformedVertices[0], transformedVertices[1],vert)<0 &&
-//            pointLineDist(transformedVertices[1], transformedVertices[2],vert)<0 &&
-//            pointLineDist(transformedVertices[2], transformedVertices[0],vert)<0)
-//            return true;
-//    }
-//    return false;
+    //faces are only split on the update thread or by tasks it waits for, so no lock is needed to publish the children;
+    //the release store makes sure a reader on another thread (see GetSurfaceRadius) does not find them before they are filled in
+    iterator.children.store(block, std::memory_order_release);
+}
+TerrainVertex Planet::generateMidpoint(const vvec3& a, const vvec3& b, const vvec3& direction, float noiseValue, vfloat fac) const
+{
+    vvec3 m = direction;
+    m*=1 + terrainHeight(noiseValue) * fac;
+    //lengths of edge vertices
+    m*=(glm::length(a)/Radius + glm::length(b)/Radius)/static_cast<vfloat>(2.)*Radius;
+    TerrainVertex vertex(m);
+    vertex.noise = noiseValue;
+    return vertex;
 }
-//signed distance
-vfloat pointLineDist(vvec2 point1, vvec2 point2, vvec2 point)
+
+bool Planet::isSplittable(const LODCandidate& c) const
+{
+    const Face& face = facePool[c.face];
+    if (!face.IsLeaf() || face.level!=c.level || face.parent!=c.parent) return false;
+    if (face.level>MAX_LOD) return false;
+    if (c.parent==NULL_FACE) return true;
+    //the parent may have been merged (and the block reused) since the entry was queued
+    FaceIndex siblings = facePool[c.parent].FirstChild();
+    return siblings!=NULL_FACE && c.face - siblings < 4;
+}
+
+bool Planet::isMergeable(const LODCandidate& c) const
+{
+    const Face& face = facePool[c.face];
+    if (face.IsLeaf() || face.level!=c.level || face.parent!=c.parent || face.level==0) return false;
+    for (int i = 0; i<4; i++)
+        if (!facePool[face.Child(i)].IsLeaf()) return false;
+    if (c.parent==NULL_FACE) return true;
+    FaceIndex siblings = facePool[c.parent].FirstChild();
+    return siblings!=NULL_FACE && c.face - siblings < 4;
+}
+
+void Planet::SetTileCache(const std::string& path, std::size_t maxBytes)
 {
-    return (glm::dot(vvec2(point2.y-point1.y,point1.x-point2.x),point)+point2.x*point1.y-point2.y*point1.x)/glm::length(point2-point1);
+    std::lock_guard<std::mutex> lock(tileCacheMutex);
+    tileCachePath = path;
+    tileCacheMaxBytes = maxBytes;
 }
 
+void Planet::SetLODMetric(std::shared_ptr<LODMetric> metric)
+{
+    std::lock_guard<std::mutex> lock(lodMetricMutex);
+    requestedLODMetric = std::move(metric);
+}
 
-//This function accepts a boolean-valued function of displacement.  If the function is true, the function will divide the given face into four subfaces, each of which will be recursively subjected to the same subdivision scheme.  It is important that the input function terminates at a particular level of detail, or the program will crash.
-bool Planet::trySubdivide(Face* iterator, Player& player)
+TerrainTileCache::Stats Planet::GetTileCacheStats()
 {
-    //perform horizon culling
-//    if (iterator->level!=0 && !inHorizon(*iterator))  return false;
-    if (iterator->level>MAX_LOD) return false;
+    std::lock_guard<std::mutex> lock(tileCacheMutex);
+    return tileCache.GetStats();
+}
+
+void Planet::updateTileCache()
+{
+    std::lock_guard<std::mutex> lock(tileCacheMutex);
+    if (tileCachePath.empty())
+    {
+        if (tileCache.IsOpen()) tileCache.Close();
+        return;
+    }
+    if (tileCache.GetPath()==tileCachePath && tileCache.GetMaxBytes()==tileCacheMaxBytes) return;
+    //the cache only saves work, so a file that cannot be used is reported and the terrain is generated without it (until the path changes)
+    try
+    {
+        tileCache.Open(tileCachePath, tileCacheMaxBytes, noise.GetSeed());
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+//Splits the leaves closest to their split distance first and merges the faces farthest beyond their merge distance first.
+//Both queues are filled by a (parallel) pass over the tree, after which merges and then splits are performed until the queues run dry or the time budget is spent.
+//The triangle budget caps the number of leaves: at the budget, a split only happens if a merge of lower priority can pay for it.
+bool Planet::updateLOD(const vvec3& camera)
+{
+    if (heightCache.GetCapacity()!=HeightCacheCapacity) heightCache.SetCapacity(HeightCacheCapacity);
+    updateTileCache();
+    {
+        std::lock_guard<std::mutex> lock(lodMetricMutex);
+        if (requestedLODMetric) lodMetric = std::move(requestedLODMetric);
+    }
+    lodMetric->BeginPass(player.Camera);
+    if (OceanMode!=oceanMode)
+    {
+        //every patch changes: faces under water are left out of (or put back into) the mesh
+        oceanMode = OceanMode;
+        for (FaceIndex root : patchRoots)
+            if (root!=NULL_FACE) markDirty(root);
+    }
+    LODCandidates candidates;
+    {
+        TaskPool::TaskGroup group;
+        for (FaceIndex f : faces)
+            taskPool.Spawn(group, [this, f, &camera, &candidates, &group]() { evaluateSubtree(f, camera, candidates, group); });
+        taskPool.Wait(group);
+    }
+    //the candidates of a pass cut short are incomplete (and were gathered for a camera position that no longer matters)
+    if (interrupted()) return false;
+    triangleCount = candidates.leaves;
+    flatLeafCount = candidates.flatLeaves;
+    submergedLeafCount = candidates.submergedLeaves;
+    //the tree is still what the frames since the last pass were drawn with (see GetLODFrameStats())
+    std::size_t frames = framesDrawn;
+    if (candidates.insufficientLeaves > 0) insufficientFrames += frames - framesEvaluated;
+    if (candidates.leaves > 0)
+        insufficientLeafFrames.store(insufficientLeafFrames.load() + static_cast<double>(frames - framesEvaluated) * candidates.insufficientLeaves / candidates.leaves);
+    framesEvaluated = frames;
+    //the budget covers the splits and merges; the pass above is proportional to the size of the tree rather than to the amount of change
+    auto deadline = std::chrono::high_resolution_clock::now() + std::chrono::microseconds(static_cast<long long>(LODTimeBudget * 1000.0));
+    std::priority_queue<LODCandidate, std::vector<LODCandidate>, std::less<LODCandidate>> splits(std::less<LODCandidate>(), std::move(candidates.splits));
+    std::priority_queue<LODCandidate, std::vector<LODCandidate>, std::greater<LODCandidate>> merges(std::greater<LODCandidate>(), std::move(candidates.merges));
     
-    if (closed) return false;
+    bool changed = false;
+    //set when a split's children were left for the next update (see ProgressiveLevels)
+    bool deferred = false;
+    auto merge = [&](const LODCandidate& c)
+    {
+        transferNormals(c.face, -1);
+        markPatchesSharing(c.face);
+        combineFace(c.face);
+        markDirty(patchOf(c.face));
+        triangleCount -= 3;
+        changed = true;
+        //the parent may have just become mergeable itself
+        const Face& face = facePool[c.face];
+        if (face.parent==NULL_FACE) return;
+        LODCandidate parent(mergePriority(facePool[face.parent], camera), face.parent, facePool[face.parent]);
+        if (isMergeable(parent)) merges.push(parent);
+    };
     
-    if (std::max(std::max(
-                                 glm::length(GetPlayerDisplacement() - iterator->vertices[0]),
-                                 glm::length(GetPlayerDisplacement() - iterator->vertices[1])),
-                        glm::length(GetPlayerDisplacement() - iterator->vertices[2]))
-        < (vfloat)(1 << LOD_MULTIPLIER) / ((vfloat)(1 << (iterator->level))))
+    //In progressive mode, merges only get half of the time while splits are waiting (unless the triangle budget forces them),
+    //so that after a jump the first meshes refine the new position rather than only clearing up the old one.
+    auto mergeDeadline = ProgressiveLevels > 0 && !splits.empty() ? deadline - std::chrono::microseconds(static_cast<long long>(LODTimeBudget * 500.0)) : deadline;
+    //faces beyond their merge distance, and anything over the triangle budget
+    while (!merges.empty() && !interrupted() && std::chrono::high_resolution_clock::now() < (triangleCount > TriangleBudget ? deadline : mergeDeadline))
     {
-        if (!iterator->AllChildrenNull())
-            return true;
-        
-        //face vertices
-        std::array<vvec3, 3> v;
-        for (int i = 0; i<3;i++)
-            v[i]=iterator->vertices[i];
-        
-        std::array<vvec2,3> p;
-        for (int i = 0; i<3;i++)
-            p[i]=iterator->polarCoords[i];
-        
-        std::array<vvec3, 3> nv;
-        for (int i = 0;i<3;i++)
-            nv[i]=glm::normalize(v[i]);
-        
-        //lengths of face vertices
-        std::array<vfloat,3> l;
-        for (int i = 0; i<3;i++)
-            l[i]=glm::length(v[i])/Radius;
-        
-        
-        //normalized midpoints of face vertices
-        vvec3 m12 = glm::normalize((nv[0] + nv[1]) * static_cast<vfloat>(0.5));
-        vvec3 m13 = glm::normalize((nv[0] + nv[2]) * static_cast<vfloat>(0.5));
-        vvec3 m23 = glm::normalize((nv[1] + nv[2]) * static_cast<vfloat>(0.5));
-        //normalized midpoints of face vertices (polar coords)
-//        vvec2 p12((v1.x+v2.x) / 2,(v1.y+v2.y) / 2);
-//        vvec2 p13((v1.x+v3.x) / 2,(v1.y+v3.y) / 2);
-//        vvec2 p23((v2.x+v3.x) / 2,(v2.y+v3.y) / 2);
-        glm::dvec2 p12(std::fmodf((v[0].x+v[1].x) / 2, M_PI),std::fmodf((v[0].y+v[1].y) / 2, M_2_PI));
-        glm::dvec2 p13(std::fmodf((v[0].x+v[2].x) / 2, M_PI),std::fmodf((v[0].y+v[2].y) / 2, M_2_PI));
-        glm::dvec2 p23(std::fmodf((v[1].x+v[2].x) / 2, M_PI),std::fmodf((v[1].y+v[2].y) / 2, M_2_PI));
-        //height scale of terrain
-        //proportional to 2^(-LOD) * nonlinear factor
-        //the nonlinear factor is LOD^(TERRAIN_REGULARITY)
-        //if the nonlinear factor is 1, the terrain is boring -- this is introduced to make higher-frequency noise more noticeable.
-        vfloat fac =static_cast<vfloat>(3.)/static_cast<vfloat>(1 << iterator->level)*std::pow(static_cast<vfloat>(iterator->level+1), TERRAIN_REGULARITY);
-        
-        m12*=1 + terrainNoise(p12) * fac;
-        m13*=1 + terrainNoise(p13) * fac;
-        m23*=1 + terrainNoise(p23) * fac;
-        
-        m12*=(l[0] + l[1])/static_cast<vfloat>(2.)*Radius;
-        m13*=(l[0] + l[2])/static_cast<vfloat>(2.)*Radius;
-        m23*=(l[1] + l[2])/static_cast<vfloat>(2.)*Radius;
-        
-//        m12+=Position;
-//        m13+=Position;
-//        m23+=Position;
-        Face *f0,*f1,*f2,*f3;
-        f0 = new Face(iterator,m13,m12,m23,p13,p12,p23,iterator->level+1);
-        f1 = new Face(iterator,v[2],m13,m23,p[2],p13,p23,iterator->level+1);
-        f2 = new Face(iterator,m23,m12,v[1],p23,p12,p[1],iterator->level+1);
-        f3 = new Face(iterator,m13,v[0],m12,p13,p[0],p12,iterator->level+1);
+        LODCandidate c = merges.top();
+        if (c.priority > MERGE_PRIORITY && triangleCount <= TriangleBudget) break;
+        merges.pop();
+        if (isMergeable(c)) merge(c);
+    }
+    
+    std::vector<LODCandidate> batch;
+    while (!splits.empty() && !interrupted() && std::chrono::high_resolution_clock::now() < deadline)
+    {
+        batch.clear();
+        while (!splits.empty() && batch.size() < SPLIT_BATCH)
+        {
+            LODCandidate c = splits.top();
+            if (!isSplittable(c)) { splits.pop(); continue; }
+            if (triangleCount + 3 * (batch.size() + 1) > TriangleBudget)
+            {
+                //at the budget: make room by merging a less important face, if there is one (but not for the predicted camera position)
+                if (batch.empty() && c.priority > 1 && !merges.empty() && merges.top().priority < c.priority && merges.top().face!=c.parent)
+                {
+                    LODCandidate m = merges.top();
+                    merges.pop();
+                    if (isMergeable(m)) merge(m);
+                    continue;
+                }
+                break;
+            }
+            batch.push_back(c);
+            splits.pop();
+        }
+        if (batch.empty()) break;
         
+        //the faces of a batch are distinct leaves, so they can be split in parallel
+        TaskPool::TaskGroup group;
+        for (const LODCandidate& c : batch)
         {
-            std::lock_guard<std::mutex> lock(renderMutex);
-            iterator->children = {f0, f1, f2, f3};
+            FaceIndex f = c.face;
+            taskPool.Spawn(group, [this, f]() { subdivideFace(f); });
         }
+        taskPool.Wait(group);
         
-        return true;
+        for (const LODCandidate& c : batch)
+        {
+            triangleCount += 3;
+            changed = true;
+            //vertex normals and patch flags are shared between faces, so they are updated here rather than by the parallel splits
+            transferNormals(c.face, 1);
+            markPatchesSharing(c.face);
+            widenCones(c.face);
+            markDirty(patchOf(c.face));
+            if (facePool[c.face].level % PATCH_DEPTH == 0 && facePool[c.face].patch==NULL_PATCH) createPatch(c.face);
+            const Face& face = facePool[c.face];
+            merges.push(LODCandidate(mergePriority(face, camera), c.face, face));
+            for (int i = 0; i<4; i++)
+            {
+                const Face& child = facePool[face.Child(i)];
+                vfloat priority = queuedSplitPriority(child, camera);
+                if (priority <= 0 || static_cast<int>(child.level) > MAX_LOD || isFlat(child) || isSubmerged(child)) continue;
+                //deeper levels wait until the mesh so far has been published
+                if (ProgressiveLevels > 0 && c.descent + 1 >= ProgressiveLevels) deferred = true;
+                else splits.push(LODCandidate(priority, face.Child(i), child, c.descent + 1));
+            }
+        }
     }
-    return false;
+    refinementPending = deferred || (std::chrono::high_resolution_clock::now() >= deadline &&
+        (!splits.empty() || (!merges.empty() && merges.top().priority <= MERGE_PRIORITY)));
+    return changed;
 }
-//Similarly to trySubdivide, this function combines four faces into a larger face if a boolean-valued function is statisfied.
-bool Planet::tryCombine(Face* iterator, Player& player)
+
+void Planet::createPatch(FaceIndex root)
 {
-    if (closed) return false;
-    if (iterator==nullptr) return false;
-    if (iterator->AnyChildrenNull()) return false;
-    
-    
-    
-    if (std::min(std::min(
-                                                                        glm::length(GetPlayerDisplacement() - iterator->vertices[0]),
-                                                                        glm::length(GetPlayerDisplacement() - iterator->vertices[1])),
-                                                               glm::length(GetPlayerDisplacement() - iterator->vertices[2]))
-        >= (vfloat)(1 << (LOD_MULTIPLIER)) / ((vfloat)(1 << (iterator->level-1))) && iterator->level>0)
+    PatchIndex slot;
+    if (freePatches.empty())
     {
-        
-        combineFace(iterator);
-        
-        if (iterator->parent!=nullptr) tryCombine(iterator->parent, player);
-        
+        slot = static_cast<PatchIndex>(patchRoots.size());
+        patchRoots.push_back(root);
+        patchMeshes.push_back(nullptr);
+        patchChildren.emplace_back();
+        patchCulling.emplace_back();
+    }
+    else
+    {
+        slot = freePatches.back();
+        freePatches.pop_back();
+        patchRoots[slot] = root;
+        patchCulling[slot] = PatchCullState();
+    }
+    facePool[root].patch = slot;
+    //the enclosing patch was made when the face at its root was split, so it already exists
+    if (facePool[root].parent!=NULL_FACE)
+        patchChildren[facePool[patchOf(facePool[root].parent)].patch].push_back(slot);
+    markDirty(root);
+}
+
+void Planet::releasePatch(FaceIndex root)
+{
+    Face& face = facePool[root];
+    //only faces whose children are leaves are combined, so no patch is left below this one
+    if (face.parent!=NULL_FACE)
+    {
+        std::vector<PatchIndex>& siblings = patchChildren[facePool[patchOf(face.parent)].patch];
+        siblings.erase(std::find(siblings.begin(), siblings.end(), face.patch));
+    }
+    patchRoots[face.patch] = NULL_FACE;
+    patchMeshes[face.patch].reset();
+    freePatches.push_back(face.patch);
+    face.patch = NULL_PATCH;
+    face.dirty = false;
+}
+
+SubdivisionAddress Planet::addressOf(FaceIndex index) const
+{
+    //the child indices on the way up are the address's low bits, two at a time
+    SubdivisionAddress path = 0;
+    unsigned int shift = 0;
+    for (FaceIndex parent = facePool[index].parent; parent!=NULL_FACE; index = parent, parent = facePool[index].parent, shift += 2)
+        path |= static_cast<SubdivisionAddress>(index - facePool[parent].FirstChild()) << shift;
+    SubdivisionAddress root = static_cast<SubdivisionAddress>(std::find(faces.begin(), faces.end(), index) - faces.begin());
+    return ((ROOT_ADDRESS | root) << shift) | path;
+}
+
+void Planet::computeBounds(Face& f) const
+{
+    //Every vertex below the face lies in the cone of directions spanned by its corners (midpoints are normalized sums of the directions of the edge ends),
+    //which is within the angle g of the direction of the face's center, and between the radii reachable from the corners (see reliefFactor and sinkFactor).
+    //The farthest such point from the center is at one of the two radii, g away from its direction.
+    vvec3 center = faceCenter(f);
+    vfloat c = glm::length(center);
+    vfloat cosG = 1, lowest = std::numeric_limits<vfloat>::max(), highest = 0;
+    for (VertexIndex v : f.vertices)
+    {
+        const vvec3& p = vertexPosition(v);
+        vfloat r = glm::length(p);
+        cosG = std::min(cosG, glm::dot(center, p) / (c * r));
+        lowest = std::min(lowest, r);
+        highest = std::max(highest, r);
+    }
+    unsigned int level = std::min(static_cast<unsigned int>(f.level), static_cast<unsigned int>(reliefFactor.size() - 1));
+    vfloat rMin = lowest * sinkFactor[level], rMax = highest * reliefFactor[level];
+    vfloat farthest = std::max(rMin * rMin + c * c - 2 * rMin * c * cosG, rMax * rMax + c * c - 2 * rMax * c * cosG);
+    f.boundsCenter = glm::vec3(center);
+    //rounded up, as the bounds are kept in single precision
+    f.boundsRadius = static_cast<float>(std::sqrt(std::max(farthest, static_cast<vfloat>(0))) * static_cast<vfloat>(1.0001));
+    f.coneCos = 1;
+}
+
+void Planet::widenCones(FaceIndex index)
+{
+    //A cone of angle a around axis n contains one of angle a' around n' if a >= angle(n, n') + a'.
+    //Cones only widen, so the walk up stops at the first ancestor that already contains its child's.
+    //A patch whose root's cone widens may have been culled as facing away, so its cached result is dropped.
+    auto contain = [this](Face& outer, const Face& inner)
+    {
+        float angle = std::acos(std::max(-1.0f, std::min(1.0f, glm::dot(outer.normal, inner.normal)))) + std::acos(inner.coneCos);
+        float cosine = angle >= static_cast<float>(M_PI) ? -1.0f : std::cos(angle);
+        if (cosine >= outer.coneCos) return false;
+        outer.coneCos = cosine;
+        if (outer.patch!=NULL_PATCH) patchCulling[outer.patch] = PatchCullState();
         return true;
+    };
+    Face& face = facePool[index];
+    bool widened = false;
+    for (int i = 0; i<4; i++)
+        widened |= contain(face, facePool[face.Child(i)]);
+    if (!widened) return;
+    while (facePool[index].parent!=NULL_FACE && contain(facePool[facePool[index].parent], facePool[index]))
+        index = facePool[index].parent;
+}
+
+void Planet::transferNormals(FaceIndex index, vfloat sign)
+{
+    const Face& face = facePool[index];
+    accumulateNormal(face, -sign);
+    for (int i = 0; i<4; i++)
+        accumulateNormal(facePool[face.Child(i)], sign);
+}
+
+void Planet::markPatchesSharing(FaceIndex index)
+{
+    const Face& face = facePool[index];
+    //the first child's corners are the face's edge midpoints (see subdivideFace)
+    FaceIndex middle = face.FirstChild();
+    for (int i = 0; i<3; i++)
+    {
+        markPatchesUsing(face.vertices[i], index);
+        markPatchesUsing(facePool[middle].vertices[i], middle);
     }
-    return false;
 }
 
-void Planet::combineFace(Face* face)
+//Every face with a vertex as a corner has exactly one child with it as a corner, so the leaves using the vertex are found, without any geometry,
+//by walking the fan of faces around it at the level it was made at and following each of them down through the children at the vertex.
+void Planet::markPatchesUsing(VertexIndex vertex, FaceIndex index)
 {
-//    std::lock_guard<std::mutex> lock(renderMutex);
-    //locking here leads to stalling at deep levels; currently disabled.
-    if (closed) return;
-    if (face->level==0) return;
-    for (Face*& f : face->children)
-        if (f!=nullptr)
+    auto hasCorner = [this](FaceIndex f, VertexIndex v) { const std::array<VertexIndex, 3>& c = facePool[f].vertices; return c[0]==v || c[1]==v || c[2]==v; };
+    while (facePool[index].parent!=NULL_FACE && hasCorner(facePool[index].parent, vertex)) index = facePool[index].parent;
+    auto markLeaf = [&](FaceIndex f)
+    {
+        while (!facePool[f].IsLeaf())
         {
-            combineFace(f);
-            delete f;
-            f = nullptr;
+            FaceIndex child = facePool[f].FirstChild();
+            while (!hasCorner(child, vertex)) child++;
+            f = child;
         }
+        markDirty(patchOf(f));
+    };
+    auto otherCorner = [&](FaceIndex f, VertexIndex skip)
+    {
+        for (VertexIndex v : facePool[f].vertices)
+            if (v!=vertex && v!=skip) return v;
+        return NULL_VERTEX;
+    };
+    markLeaf(index);
+    //around the fan one way, and if it is open (at the edge of the refined terrain), the other way as well
+    VertexIndex first = otherCorner(index, NULL_VERTEX);
+    VertexIndex starts[2] = {first, otherCorner(index, first)};
+    for (VertexIndex edge : starts)
+    {
+        FaceIndex current = index;
+        //no vertex has more than six faces around it
+        for (int step = 0; step<6; step++)
+        {
+            FaceIndex next = neighbourAcross(current, vertex, edge);
+            if (next==NULL_FACE) break;
+            if (next==index) return;
+            markLeaf(next);
+            edge = otherCorner(next, edge);
+            current = next;
+        }
+    }
+}
+
+FaceIndex Planet::neighbourAcross(FaceIndex index, VertexIndex a, VertexIndex b) const
+{
+    auto hasEdge = [this, a, b](FaceIndex f) { const std::array<VertexIndex, 3>& c = facePool[f].vertices;
+        return (c[0]==a || c[1]==a || c[2]==a) && (c[0]==b || c[1]==b || c[2]==b); };
+    const Face& face = facePool[index];
+    if (face.parent==NULL_FACE)
+    {
+        for (FaceIndex f : faces)
+            if (f!=index && hasEdge(f)) return f;
+        return NULL_FACE;
+    }
+    FaceIndex siblings = facePool[face.parent].FirstChild();
+    for (FaceIndex f = siblings; f<siblings + 4; f++)
+        if (f!=index && hasEdge(f)) return f;
+    //Otherwise the edge is half of one of the parent's edges: one end is a corner of the parent and the other that edge's midpoint,
+    //and the neighbour is the child, at that corner, of the parent's neighbour across the edge.
+    const Face& parent = facePool[face.parent];
+    const std::array<VertexIndex, 3>& midpoints = facePool[siblings].vertices;
+    //parent edges in the order of the midpoints of the first child: (0,2), (0,1), (1,2)
+    const int edges[3][2] = {{0,2},{0,1},{1,2}};
+    for (int i = 0; i<3; i++)
+    {
+        VertexIndex p = parent.vertices[edges[i][0]], q = parent.vertices[edges[i][1]];
+        if (midpoints[i]!=a && midpoints[i]!=b) continue;
+        if (p!=a && p!=b && q!=a && q!=b) continue;
+        FaceIndex other = neighbourAcross(face.parent, p, q);
+        if (other==NULL_FACE || facePool[other].IsLeaf()) return NULL_FACE;
+        FaceIndex children = facePool[other].FirstChild();
+        for (FaceIndex f = children; f<children + 4; f++)
+            if (hasEdge(f)) return f;
+        return NULL_FACE;
+    }
+    return NULL_FACE;
+}
+
+//Nothing is freed here: readers on other threads may still be walking the subtree, so its blocks and vertices are retired (see epochs) rather than locked.
+void Planet::combineFace(FaceIndex index)
+{
+    if (closed) return;
+    Face& face = facePool[index];
+    if (face.level==0) return;
+    if (face.IsLeaf()) return;
+    for (int i = 0; i<4; i++)
+        combineFace(face.Child(i));
+    if (face.patch!=NULL_PATCH) releasePatch(index);
+    //the midpoints' noise is kept for when the face is split again; the first child's corners are the midpoints 13, 12 and 23 (see subdivideFace)
+    const Face& middle = facePool[face.FirstChild()];
+    HeightCache::Value noiseValues = {{vertexPool[middle.vertices[1]].noise, vertexPool[middle.vertices[0]].noise, vertexPool[middle.vertices[2]].noise}};
+    heightCache.Insert(addressOf(index), noiseValues);
+    //the neighbour across an edge may still be using its midpoint
+    std::uint64_t epoch = epochs.Current();
+    const int edges[3][2] = {{0,1},{0,2},{1,2}};
+    for (int i = 0; i<3; i++)
+    {
+        VertexIndex midpoint = vertexPool.ReleaseMidpoint(face.vertices[edges[i][0]], face.vertices[edges[i][1]]);
+        if (midpoint!=NULL_VERTEX) retiredVertices.Retire(midpoint, epoch);
+    }
+    FaceIndex block = face.FirstChild();
+    //the children stay readable (retired, not freed) for readers that loaded the index before this
+    face.children.store(NULL_FACE, std::memory_order_release);
+    retiredFaces.Retire(block, epoch);
+}
+
+void Planet::reclaimRetired()
+{
+    std::uint64_t safe = epochs.Advance();
+    retiredFaces.Reclaim(safe, [this](FaceIndex block) { facePool.FreeBlock(block); });
+    retiredVertices.Reclaim(safe, [this](VertexIndex vertex) { vertexPool.Free(vertex); });
 }
 //performed in background, manages terrain generation
 void Planet::Update()
 {
     while (true)
     {
-        if (closed) return;
-        subdivided = false;
+        vvec3 camera, velocity;
+        std::chrono::high_resolution_clock::time_point snapshot;
+        {
+            std::unique_lock<std::mutex> lock(updateMutex);
+            //nothing changes while neither the player nor the planet moves, so sleep until requestUpdate() says otherwise
+            updateCondition.wait(lock, [this]() { return closed || updateRequested || refinementPending; });
+            if (closed) return;
+            updateRequested = false;
+            camera = cameraSnapshot;
+            velocity = cameraVelocity;
+            snapshot = snapshotTime;
+            updatingCamera = camera;
+            //an update restarted once runs to the end
+            cancellable = !updateCancelled;
+            updateCancelled = false;
+        }
+        //by the time this mesh is drawn (and the next one is made), the camera will have moved on
+        speculating = false;
+        if (SpeculationLookahead > 0)
+        {
+            vvec3 ahead = velocity * static_cast<vfloat>(SpeculationLookahead * updateLatency);
+            vfloat altitude = std::max(static_cast<vfloat>(glm::length(camera)) - Radius, static_cast<vfloat>(1.0e-6));
+            //a prediction closer than the distance that triggers an update would change nothing
+            if (glm::length(ahead) > UpdateDistanceThreshold * altitude)
+            {
+                predictedCamera = camera + ahead;
+                if (glm::length(predictedCamera) < Radius) predictedCamera = glm::normalize(predictedCamera) * Radius;
+                speculating = true;
+            }
+        }
         //iterate through faces and perform necessary generation checks
         
         
@@ -244,30 +673,33 @@ void Planet::Update()
 //                                                                                 glm::length(GetPlayerDisplacement() - f.vertices[2]))
 //                >= (vfloat)(1 << (LOD_MULTIPLIER)) / ((vfloat)(1 << (f.level-1))); }, player);
         
+        UpdateTimings timings;
         auto t = std::chrono::high_resolution_clock::now();
         
-        for (auto it = faces.begin();it!=faces.end();it++)
+        updateLOD(camera);
+        timings.lod = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t).count();
+        
+        //update vertices if changes were made (also publishes changes to horizon culling)
+        if (!interrupted()) updateVBO(player, camera, timings);
+        reclaimRetired();
+        timings.triangles = triangleCount;
+        timings.flatLeaves = flatLeafCount;
+        timings.submergedLeaves = submergedLeafCount;
         {
-            if (recursiveCombine(&(*it), player))
-                subdivided=true;
-            if (recursiveSubdivide(&(*it), player))
-                subdivided=true;
+            std::lock_guard<std::mutex> lock(updateMutex);
+            timings.cancelled = updateCancelled;
+            cancellable = false;
         }
-    //    printf("1 time taken: %lli us\n", std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - t).count());
-        
-        //update vertices if changes were made
-        
-        t = std::chrono::high_resolution_clock::now();
-        
-        size_t indsize, vertsize;
-        GetIndicesVerticesSizes(indsize, vertsize);
-        if (subdivided || vertsize==0)
+        if (!timings.cancelled)
         {
-            updateVBO(player);
-            lastPlayerUpdatePosition=player.Position;
+            double latency = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - snapshot).count();
+            updateLatency = updateLatency==0 ? latency : updateLatency + 0.25 * (latency - updateLatency);
+        }
+        if (RecordTimings)
+        {
+            std::lock_guard<std::mutex> lock(timingsMutex);
+            updateTimings.push_back(timings);
         }
-    //    printf("2 time taken: %lli us\n", std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - t).count());
-    //    std::cout << "Height above earth surface: " << player.DistFromSurface * EARTH_DIAMETER << " m\n";
         //repeat indefinitely (on separate thread)
     }
 }
@@ -283,17 +715,14 @@ void Planet::generateBuffers()
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
     glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
     //set up vertex attributes.  These contain position and normal data for each vertex.
     //Use preprocessor conditionals to differentiate between two possible precisions
 #ifdef VERTEX_DOUBLE
     glVertexAttribLPointer(0, 3, GL_DOUBLE, sizeof(Vertex), (void*)__offsetof(Vertex, x));
-    glVertexAttribLPointer(1, 2, GL_DOUBLE, sizeof(Vertex), (void*)__offsetof(Vertex, tx));
     glVertexAttribLPointer(2, 3, GL_DOUBLE, sizeof(Vertex), (void*)__offsetof(Vertex, nx));
 #else
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),(void*)__offsetof(Vertex, x));
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),(void*)__offsetof(Vertex, tx));
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),(void*)__offsetof(Vertex, nx));
 #endif
     //unbind VAO
@@ -303,51 +732,49 @@ void Planet::generateBuffers()
 
 //Deprecated.  This function is a higher-performance alternative to the currently implemented sorting scheme in updateVBO().
 //It is faster (sometimes by a factor of 3), but it produces non-ideal normal discontinuities (mainly due to the recursive implementation of the function).
-void Planet::recursiveUpdate(Face& face, unsigned int index1, unsigned int index2, unsigned int index3, Player& player, std::vector<Vertex>& newVertices, std::vector<unsigned int>& newIndices)
+void Planet::recursiveUpdate(FaceIndex index, unsigned int index1, unsigned int index2, unsigned int index3, const CullingVolume& volume, unsigned int mask, std::vector<Vertex>& newVertices, std::vector<unsigned int>& newIndices)
 {
     if (closed) return;
-    //Get player distance from face.  If temporary minimum, set player distance (this process naturally finds the player's minimum distance to the surface).
-    {
-        std::lock_guard<std::mutex> lock(renderMutex);
-        vfloat dist = std::min(std::min(glm::length(GetPlayerDisplacement() - face.vertices[0]),glm::length(GetPlayerDisplacement() - face.vertices[1])),glm::length(GetPlayerDisplacement()- face.vertices[2]));
-        if (player.DistFromSurface > dist) player.DistFromSurface = dist;
-    }
-    //perform horizon culling
-    if (face.level!=0 && !inHorizon(face)) return;
-    if (!faceInView(face)) return;
-    if (!face.AnyChildrenNull())
+    Face& face = facePool[index];
+    //horizon, back-face and view culling of the whole subtree
+    vfloat margin = 0;
+    if (mask!=0 && !cullFace(face, volume, mask, margin)) return;
+    //in ocean mode, the shell covers whatever is entirely under water
+    if (isSubmerged(face)) return;
+    if (!face.IsLeaf())
     {
-        vvec3 norm = face.GetNormal();
+        vvec3 norm = vvec3(face.normal);
         unsigned int ni1,ni2,ni3; //new indices
         unsigned int currIndex=(unsigned)newVertices.size();
-        if (face.level==0)
+        //the root of the patch being extracted (deeper patches are extracted separately)
+        if (face.patch!=NULL_PATCH)
         {
-            newVertices.push_back(Vertex(face.vertices[0], (vvec2)face.polarCoords[0], norm));
-            newVertices.push_back(Vertex(face.vertices[1], (vvec2)face.polarCoords[1], norm));
-            newVertices.push_back(Vertex(face.vertices[2], (vvec2)face.polarCoords[2], norm));
+            for (VertexIndex v : face.vertices)
+                newVertices.push_back(Vertex(vertexPool[v].position, norm));
             index1 = currIndex + 0;
             index2 = currIndex + 1;
             index3 = currIndex + 2;
         }
         currIndex = (unsigned)newVertices.size();
         
-        vvec3 norm0 = face.children[0]->GetNormal();
-        vvec3 norm1 = face.children[1]->GetNormal();
-        vvec3 norm2 = face.children[2]->GetNormal();
-        vvec3 norm3 = face.children[3]->GetNormal();
+        vvec3 norm0 = vvec3(facePool[face.Child(0)].normal);
+        vvec3 norm1 = vvec3(facePool[face.Child(1)].normal);
+        vvec3 norm2 = vvec3(facePool[face.Child(2)].normal);
+        vvec3 norm3 = vvec3(facePool[face.Child(3)].normal);
         
-        
-        newVertices.push_back(Vertex(face.children[0]->vertices[0], (vvec2)face.children[0]->polarCoords[0], glm::normalize(norm0 + norm1 + norm3)));
-        newVertices.push_back(Vertex(face.children[0]->vertices[1], (vvec2)face.children[0]->polarCoords[1], glm::normalize(norm0 + norm1 + norm2)));
-        newVertices.push_back(Vertex(face.children[0]->vertices[2], (vvec2)face.children[0]->polarCoords[2], glm::normalize(norm0 + norm2 + norm3)));
+        //the middle child's vertices are the three midpoints
+        const Face& middle = facePool[face.Child(0)];
+        newVertices.push_back(Vertex(vertexPool[middle.vertices[0]].position, glm::normalize(norm0 + norm1 + norm3)));
+        newVertices.push_back(Vertex(vertexPool[middle.vertices[1]].position, glm::normalize(norm0 + norm1 + norm2)));
+        newVertices.push_back(Vertex(vertexPool[middle.vertices[2]].position, glm::normalize(norm0 + norm2 + norm3)));
         ni1 = currIndex + 0;
         ni2 = currIndex + 1;
         ni3 = currIndex + 2;
         
-        recursiveUpdate(*face.children[0], ni1, ni2, ni3, player, newVertices, newIndices);
-        recursiveUpdate(*face.children[1], index3, ni1, ni3, player,newVertices, newIndices);
-        recursiveUpdate(*face.children[2], ni3, ni2, index2, player,newVertices, newIndices);
-        recursiveUpdate(*face.children[3], ni1, index1,ni2, player,newVertices, newIndices);
+        if (facePool[face.Child(0)].patch==NULL_PATCH) recursiveUpdate(face.Child(0), ni1, ni2, ni3, volume, mask, newVertices, newIndices);
+        if (facePool[face.Child(1)].patch==NULL_PATCH) recursiveUpdate(face.Child(1), index3, ni1, ni3, volume, mask, newVertices, newIndices);
+        if (facePool[face.Child(2)].patch==NULL_PATCH) recursiveUpdate(face.Child(2), ni3, ni2, index2, volume, mask, newVertices, newIndices);
+        if (facePool[face.Child(3)].patch==NULL_PATCH) recursiveUpdate(face.Child(3), ni1, index1,ni2, volume, mask, newVertices, newIndices);
     }
     else
     {
@@ -358,160 +785,296 @@ void Planet::recursiveUpdate(Face& face, unsigned int index1, unsigned int index
 }
 
 
-bool Planet::recursiveSubdivide(Face* face, Player& player)
+void Planet::cullPatches(PatchIndex patch, const CullingVolume& volume, unsigned int mask, std::vector<unsigned int>& visible, vfloat& nearest, std::size_t& tests)
 {
-    if (trySubdivide(face, player))
+    //The last result stands until the camera has moved by its margin, or the tests asked for change, so the root face is only read for patches near the boundary of the view.
+    PatchCullState& state = patchCulling[patch];
+    if (cullDistance >= state.retestAt || mask!=state.testedMask)
     {
-        for (Face* f:face->children) recursiveSubdivide(f, player);
-        return true;
+        const Face& root = facePool[patchRoots[patch]];
+        state.testedMask = mask;
+        vfloat margin = std::numeric_limits<vfloat>::max();
+        state.visible = mask==0 || cullFace(root, volume, mask, margin);
+        state.passedMask = mask;
+        state.testedAt = cullDistance;
+        state.retestAt = cullDistance + margin;
+        state.distance = glm::length(vvec3(root.boundsCenter) - volume.camera) - root.boundsRadius;
+        tests++;
     }
-    return false;
+    if (!state.visible) return;
+    mask = state.passedMask;
+    visible.push_back(patch);
+    //the distance to the bounds shrinks by at most the distance travelled since the test
+    nearest = std::min(nearest, std::max(static_cast<vfloat>(state.distance - (cullDistance - state.testedAt)), static_cast<vfloat>(0)));
+    for (PatchIndex child : patchChildren[patch])
+        cullPatches(child, volume, mask, visible, nearest, tests);
 }
 
-
-bool Planet::recursiveCombine(Face* face, Player& player)
+void Planet::recursiveEvaluate(FaceIndex index, const vvec3& camera, LODCandidates& candidates, LODCandidates& shared, TaskPool::TaskGroup& group)
 {
-    if (closed) return false;
-    if (face==nullptr) return false;
-    if (!tryCombine(face, player))
+    if (interrupted()) return;
+    const Face& face = facePool[index];
+    if (face.IsLeaf())
     {
-        for (auto& child:face->children)
-            recursiveCombine(child, player);
-        return false;
+        candidates.leaves++;
+        vfloat priority = queuedSplitPriority(face, camera);
+        if (isSubmerged(face)) candidates.submergedLeaves++;
+        else if (priority > 0 && static_cast<int>(face.level) <= MAX_LOD)
+        {
+            //only what the current camera position needs is counted; the prediction may be wrong
+            if (isFlat(face)) candidates.flatLeaves += priority > 1;
+            else
+            {
+                candidates.splits.push_back(LODCandidate(priority, index, face));
+                candidates.insufficientLeaves += priority > INSUFFICIENT_PRIORITY;
+            }
+        }
+        return;
+    }
+    bool childrenAreLeaves = true;
+    for (int i = 0; i<4; i++)
+        childrenAreLeaves &= facePool[face.Child(i)].IsLeaf();
+    //every mergeable face is queued (not only those past the merge distance), since the triangle budget may force lower-priority merges
+    if (childrenAreLeaves && face.level>0) candidates.merges.push_back(LODCandidate(mergePriority(face, camera), index, face));
+    for (int i = 0; i<4; i++)
+    {
+        FaceIndex child = face.Child(i);
+        //the last child is always evaluated on this thread; the others are offered to idle workers
+        if (i<3 && taskPool.WantsTasks())
+            taskPool.Spawn(group, [this, child, &camera, &shared, &group]() { evaluateSubtree(child, camera, shared, group); });
+        else
+            recursiveEvaluate(child, camera, candidates, shared, group);
     }
-    else return true;
 }
 
-void Planet::getRootFaces(std::vector<Face*>& rootFaces, Player& player)
+void Planet::evaluateSubtree(FaceIndex index, const vvec3& camera, LODCandidates& shared, TaskPool::TaskGroup& group)
 {
-    for (Face& f:faces)
-        recursiveGetRootFaces(rootFaces, &f,player);
+    LODCandidates local;
+    recursiveEvaluate(index, camera, local, shared, group);
+    std::lock_guard<std::mutex> lock(candidateMutex);
+    shared.splits.insert(shared.splits.end(), local.splits.begin(), local.splits.end());
+    shared.merges.insert(shared.merges.end(), local.merges.begin(), local.merges.end());
+    shared.leaves += local.leaves;
+    shared.flatLeaves += local.flatLeaves;
+    shared.submergedLeaves += local.submergedLeaves;
+    shared.insufficientLeaves += local.insufficientLeaves;
 }
-void Planet::recursiveGetRootFaces(std::vector<Face *> &rootFaces, Face* f, Player& player)
+
+void Planet::recursiveGetRootFaces(std::vector<FaceIndex> &rootFaces, FaceIndex index)
 {
-    if (f==nullptr) return;
-    if (!inHorizon(*f) && f->level!=0) return;
-//    if (!faceInView(*f)) return;
-    for (auto& i:f->indices)i=-1;
-    if (f->AllChildrenNull())
-        rootFaces.push_back(f);
+    if (index==NULL_FACE) return;
+    const Face& f = facePool[index];
+    //in ocean mode, the shell covers whatever is entirely under water
+    if (isSubmerged(f)) return;
+    if (f.IsLeaf())
+        rootFaces.push_back(index);
     else
-        for (Face* child:f->children)
-            recursiveGetRootFaces(rootFaces, child,player);
+        for (int i = 0; i<4; i++)
+        {
+            //deeper patches are extracted on their own
+            if (facePool[f.Child(i)].patch==NULL_PATCH) recursiveGetRootFaces(rootFaces, f.Child(i));
+        }
 }
 
-void Planet::updateVBO(Player& player)
-{
-    const vfloat displacementThreshold=0.1;
-    auto t = std::chrono::high_resolution_clock::now();
-    size_t indsize, vertsize;
-    GetIndicesVerticesSizes(indsize, vertsize);
-    std::vector<Vertex> newVertices;
-    newVertices.reserve(vertsize);
-    std::vector<unsigned int> newIndices;
-    newIndices.reserve(indsize);
-    player.DistFromSurface=10.;
-    
+//smooth faces are extracted a whole patch at a time; only flat faces are culled one by one against the volume
 #ifdef SMOOTH_FACES
-    
-    std::vector<Face*> rootFaces;
-    getRootFaces(rootFaces,player);
-    std::vector<std::pair<int, int>> verticesSorted(rootFaces.size()*3);
-    
-    for (int i = 0; i<rootFaces.size();i++)
-    {
-        verticesSorted[3*i] = std::pair<int, int>(0,i);
-        verticesSorted[3*i+1] = std::pair<int, int>(1,i);
-        verticesSorted[3*i+2] = std::pair<int, int>(2,i);
-    }
-    
-    
-    const auto func =[this, &rootFaces](std::pair<int, int>& p1, std::pair<int, int>& p2)
-    {
-        glm::dvec2 c1=rootFaces[p1.second]->polarCoords[p1.first] + glm::dvec2(M_PI,M_2_PI);
-        glm::dvec2 c2=rootFaces[p2.second]->polarCoords[p2.first] + glm::dvec2(M_PI,M_2_PI);
-        
-        //                  return c1.x + 2 * Radius * c1.y + 4 * Radius * Radius * c1.z <
-        //                  c2.x + 2 * Radius * c2.y + 4 * Radius * Radius * c2.z;
-        return c1.x + 20*M_2_PI * c1.y < c2.x + 20*M_2_PI*c2.y; //this multiplier must be sufficiently large to separate the x and y components of the polar coordinates
-    };
-    //    if (getPlayerDisplacementSquared(player)>displacementThreshold) return;
-    t = std::chrono::high_resolution_clock::now();
-
-#ifdef USE_HEAP
-    std::make_heap(verticesSorted.begin(), verticesSorted.end(),func);
-    std::sort_heap(verticesSorted.begin(),verticesSorted.end(),func);
+std::shared_ptr<const PatchMesh> Planet::extractPatch(FaceIndex root, const CullingVolume& /*volume*/)
 #else
-    std::sort(verticesSorted.begin(), verticesSorted.end(),func);
+std::shared_ptr<const PatchMesh> Planet::extractPatch(FaceIndex root, const CullingVolume& volume)
 #endif
-    //    if (getPlayerDisplacementSquared(player)>displacementThreshold) return;
-//    printf("Time: %lli\n", std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now()-t).count());
-        for (int j = 0; j<verticesSorted.size();j++)
+{
+    std::shared_ptr<PatchMesh> patch = std::make_shared<PatchMesh>();
+    std::vector<Vertex>& newVertices = patch->vertices;
+    std::vector<unsigned int>& newIndices = patch->indices;
+#ifdef SMOOTH_FACES
+    std::vector<FaceIndex> rootFaces;
+    recursiveGetRootFaces(rootFaces, root);
+    
+    //Neighbouring faces reference the same TerrainVertex, so each is emitted once, the first time a leaf uses it.
+    //The vertex-to-index map is a small hash table local to the patch: vertices on its border also belong to the neighbouring patches, which may be extracted at the same time.
+    std::size_t slotCount = 16;
+    while (slotCount < 6 * rootFaces.size()) slotCount <<= 1;
+    std::vector<std::pair<VertexIndex, unsigned int>> emitted(slotCount, std::make_pair(NULL_VERTEX, 0u));
+    newIndices.reserve(3 * rootFaces.size());
+    //Smooth normals are the average of the normals of every face sharing a vertex, which the vertex keeps summed up.
+    for (FaceIndex index:rootFaces)
     {
-        const int maxNeighbors=6;
-        
-        if (rootFaces.at(verticesSorted[j].second)->indices.at(verticesSorted[j].first)!=-1) continue;
-        int currentSize = (int)newVertices.size();
-        
-        vvec3 normal = rootFaces.at(verticesSorted[j].second)->GetNormal();
-        
-        newVertices.push_back(Vertex(rootFaces.at(verticesSorted[j].second)->vertices.at(verticesSorted[j].first),(vvec2)rootFaces.at(verticesSorted[j].second)->polarCoords.at(verticesSorted[j].first), vvec3()));
-        
-        rootFaces.at(verticesSorted[j].second)->indices.at(verticesSorted[j].first)=currentSize;
-        int neig=0;
-        
-        for (int k = std::max(0, j-maxNeighbors);k<std::min((int)verticesSorted.size(),j+maxNeighbors);k++)
+        const Face& f = facePool[index];
+        for (VertexIndex v:f.vertices)
         {
-            if (neig>maxNeighbors) break;
-            if (k==j) continue;
-            if (rootFaces.at(verticesSorted[k].second)->indices.at(verticesSorted[k].first)!=-1) continue;
-            glm::dvec2 v1 = rootFaces.at(verticesSorted[k].second)->polarCoords.at(verticesSorted[k].first);
-            glm::dvec2 v2 = rootFaces.at(verticesSorted[j].second)->polarCoords.at(verticesSorted[j].first);
-            if (glm::length2(v1-v2)<std::numeric_limits<double>::epsilon())
+            std::size_t slot = (v * 0x9E3779B1u) & (slotCount - 1);
+            while (emitted[slot].first!=NULL_VERTEX && emitted[slot].first!=v) slot = (slot + 1) & (slotCount - 1);
+            if (emitted[slot].first==NULL_VERTEX)
             {
-                rootFaces.at(verticesSorted[k].second)->indices.at(verticesSorted[k].first) = currentSize;
-                normal += rootFaces.at(verticesSorted[k].second)->GetNormal();
-                neig++;
+                const TerrainVertex& vertex = vertexPool[v];
+                emitted[slot] = std::make_pair(v, (unsigned int)newVertices.size());
+                newVertices.push_back(Vertex(vertex.position, glm::normalize(vertex.normal)));
             }
+            newIndices.push_back(emitted[slot].second);
         }
-        //This corrects seams. It leads to other unintended artifacts, so it is currently disabled.
-//        if (neig<2)
-//        {
-//            vvec3 disp = rootFaces.at(verticesSorted[j].second)->vertices[verticesSorted[j].first] - rootFaces.at(verticesSorted[j].second)->GetCenter();
-//            newVertices[currentSize].SetPosition(newVertices[currentSize].GetPosition() + static_cast<vfloat>(0.1) * disp);
-//        }
-//        printf("%f %f\n",
-//               rootFaces.at(verticesSorted[j].second)->polarCoords[0].x,rootFaces.at(verticesSorted[j].second)->polarCoords[0].y);
-        normal = glm::normalize(normal);
-        newVertices[currentSize].SetNormal(normal);
     }
+#else
+    recursiveUpdate(root, 0, 0, 0, volume, CULL_ALL, newVertices, newIndices);
+#endif
+    return patch;
+}
+
+void Planet::updateVBO(Player& player, const vvec3& camera, UpdateTimings& timings)
+{
+    auto t = std::chrono::high_resolution_clock::now();
     
-    for (Face* f:rootFaces)
+    //everything the culling tests take from the camera, for both the patches and (without SMOOTH_FACES) the faces of the patches being extracted
+    CullingVolume volume;
+    volume.camera = camera;
+    vfloat playerHeight = glm::length(camera) - Radius;
+    //refer to Wikipedia for formula for horizon distance
+    volume.horizonDist = std::sqrt(std::max(2*Radius * playerHeight + playerHeight * playerHeight, static_cast<vfloat>(0.05)));
+    vmat4 transform;
     {
-        if (f->indices[0]!=-1 && f->indices[1]!=-1 && f->indices[2]!=-1)
-        {
-            newIndices.push_back(f->indices[0]);
-            newIndices.push_back(f->indices[1]);
-            newIndices.push_back(f->indices[2]);
-        }
+        std::lock_guard<std::mutex> lock(renderMutex);
+        transform = PlanetInfo.transformMatrix;
     }
+    //the rows of the transform combine into the clip planes (-w <= x, y and z, and x, y <= w)
+    vvec4 rows[4];
+    for (int i = 0; i<4; i++) rows[i] = vvec4(transform[0][i], transform[1][i], transform[2][i], transform[3][i]);
+    volume.planes = {{ rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[3] + rows[2] }};
+    for (vvec4& plane : volume.planes)
     {
-        std::ofstream stream(resourcePath() + performanceOutput, std::ios::out | std::ios::app);
-        stream << rootFaces.size() << "," << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - t).count() <<"\n";
+        vfloat length = glm::length(vvec3(plane));
+        if (length > 0) plane /= length;
     }
-#else
-    for (Face& f : faces)
-        recursiveUpdate(f, 0, 0, 0, player, newVertices, newIndices);
+    
+    //only patches in which a face was split or combined are extracted again
+    std::vector<FaceIndex> roots;
+    roots.reserve(dirtyPatches.size());
+    for (FaceIndex index : dirtyPatches)
+    {
+        Face& root = facePool[index];
+        //the patch may have been released (or extracted already) after it was put on the list
+        if (!root.dirty || root.patch==NULL_PATCH) continue;
+        root.dirty = false;
+        roots.push_back(index);
+    }
+    dirtyPatches.clear();
+    //each patch is extracted into its own buffers, so the tasks share nothing but the (read-only) face tree
+    std::vector<std::shared_ptr<const PatchMesh>> extractedMeshes(roots.size());
+    std::size_t extracted = 0;
+    while (extracted < roots.size() && !interrupted())
+    {
+        std::size_t end = std::min(extracted + EXTRACTION_SLICE, roots.size());
+        TaskPool::TaskGroup group;
+        for (std::size_t i = extracted; i<end; i++)
+            taskPool.Spawn(group, [this, &roots, &extractedMeshes, &volume, i]() { extractedMeshes[i] = extractPatch(roots[i], volume); });
+        taskPool.Wait(group);
+        extracted = end;
+    }
+#ifndef SMOOTH_FACES
+    //the faces of these patches were culled for a camera position that no longer matters
+    if (interrupted()) extracted = 0;
 #endif
-//    if (getPlayerDisplacementSquared(player)>displacementThreshold) return;
-    if (!closed)
+    for (std::size_t i = 0; i<extracted; i++)
+        patchMeshes[facePool[roots[i]].patch] = extractedMeshes[i];
+    //whatever a cancelled update did not get to is left to the next one
+    for (std::size_t i = extracted; i<roots.size(); i++)
+        markDirty(roots[i]);
+    auto culling = std::chrono::high_resolution_clock::now();
+    timings.extraction = std::chrono::duration<double, std::milli>(culling - t).count();
+    timings.extractedPatches = extracted;
+    if (interrupted()) return;
+    
+    //Culling is done per patch, so camera movement alone only changes the list of visible patches.
+    //The list is only rebuilt at the rate of the updates, while the view turns at the rate of the frames, so patches are not culled against the frustum (only against the horizon and by their normals, which do not depend on the direction of the view).
+    std::vector<unsigned int> visible;
+    visible.reserve(visiblePatches.size());
+    //Every result moves by at most as much as the camera and the horizon distance do, so only the patches whose margin has been used up are tested again.
+    cullDistance += glm::length(camera - lastCullCamera) + std::abs(volume.horizonDist - lastHorizonDist);
+    lastCullCamera = camera;
+    lastHorizonDist = volume.horizonDist;
+    //the player's distance to the surface is estimated by the nearest bounds of a visible patch
+    vfloat distFromSurface = 10.;
+    for (FaceIndex f : faces)
+        cullPatches(facePool[f].patch, volume, CULL_HORIZON | CULL_FACING, visible, distFromSurface, timings.cullTests);
+    player.DistFromSurface = distFromSurface;
+    auto publish = std::chrono::high_resolution_clock::now();
+    timings.culling = std::chrono::duration<double, std::milli>(publish - culling).count();
+    timings.visiblePatches = visible.size();
+    for (unsigned int i : visible)
+        timings.meshTriangles += patchMeshes[i]->indices.size() / 3;
+    
+    if (closed || (extracted==0 && visible==visiblePatches && meshGeneration!=0 && publishedOcean==oceanMode)) return;
+    visiblePatches.swap(visible);
     {
-        std::lock_guard<std::mutex> lock(renderMutex);
-        vertices = newVertices;
-        indices = newIndices;
+        std::ofstream stream(resourcePath() + performanceOutput, std::ios::out | std::ios::app);
+        stream << extracted << "," << std::chrono::duration_cast<std::chrono::microseconds>(publish - t).count() <<"\n";
     }
+    publish = std::chrono::high_resolution_clock::now();
+    
+    //the snapshot only copies the patch table; unchanged patch meshes are shared with earlier versions
+    MeshSnapshot& snapshot = mesh.Back();
+    snapshot.patches = patchMeshes;
+    snapshot.visiblePatches = visiblePatches;
+    snapshot.ocean = oceanMode;
+    publishedOcean = oceanMode;
+    snapshot.generation = ++meshGeneration;
+    mesh.Publish();
+    timings.publish = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - publish).count();
 }
 
+std::vector<Planet::UpdateTimings> Planet::TakeUpdateTimings()
+{
+    std::vector<UpdateTimings> timings;
+    std::lock_guard<std::mutex> lock(timingsMutex);
+    timings.swap(updateTimings);
+    return timings;
+}
+
+vfloat Planet::GetSurfaceRadius(const vvec3& direction)
+{
+    EpochManager::Guard guard(epochs);
+    vvec3 d = glm::normalize(direction);
+    //how far the direction is inside the face (as seen from the centre): the least of its distances to the planes through the centre and each edge, negative outside
+    auto inside = [this, &d](FaceIndex index)
+    {
+        const Face& f = facePool[index];
+        const vvec3& a = vertexPosition(f.vertices[0]);
+        const vvec3& b = vertexPosition(f.vertices[1]);
+        const vvec3& c = vertexPosition(f.vertices[2]);
+        //the winding decides which side of each plane is inside
+        vfloat orientation = glm::dot(glm::cross(b - a, c - a), a) < 0 ? -1 : 1;
+        vvec3 n[3] = {glm::cross(a, b), glm::cross(b, c), glm::cross(c, a)};
+        vfloat distance = std::numeric_limits<vfloat>::max();
+        for (const vvec3& plane : n)
+            distance = std::min(distance, orientation * glm::dot(d, plane) / glm::length(plane));
+        return distance;
+    };
+    //the children of a face cover it exactly (midpoints are only moved along their direction), so the leaf is found by descending into the child the direction is most inside of
+    FaceIndex index = *std::max_element(faces.begin(), faces.end(), [&](FaceIndex x, FaceIndex y) { return inside(x) < inside(y); });
+    while (true)
+    {
+        FaceIndex block = facePool[index].FirstChild(std::memory_order_acquire);
+        if (block==NULL_FACE) break;
+        index = block;
+        vfloat best = inside(block);
+        for (FaceIndex child = block + 1; child<block + 4; child++)
+        {
+            vfloat distance = inside(child);
+            if (distance > best) { best = distance; index = child; }
+        }
+    }
+    const Face& leaf = facePool[index];
+    const vvec3& a = vertexPosition(leaf.vertices[0]);
+    vvec3 normal = glm::cross(vertexPosition(leaf.vertices[1]) - a, vertexPosition(leaf.vertices[2]) - a);
+    return glm::dot(normal, a) / glm::dot(normal, d);
+}
+
+Planet::LODFrameStats Planet::GetLODFrameStats() const
+{
+    LODFrameStats stats;
+    stats.Frames = framesEvaluated;
+    stats.InsufficientFrames = insufficientFrames;
+    stats.InsufficientLeafFrames = insufficientLeafFrames;
+    return stats;
+}
 
 void Planet::buildBaseMesh()
 {
@@ -519,10 +1082,6 @@ void Planet::buildBaseMesh()
     //I used code on a forum or website (unfortunately cannot find it again)
     vvec3 icosahedron[12];
     
-    vvec2 icosahedronPolar[12];
-    
-    
-    
     double sine = std::sin(icotheta);
     double cosine = std::cos(icotheta);
     
@@ -541,35 +1100,62 @@ void Planet::buildBaseMesh()
     
     icosahedron[11] = vvec3(0.0, 0.0, 1.0)*Radius; // top vertex
     
-    for (int i = 0; i<12;i++)
-    {
-        double len = glm::length(icosahedron[i]);
-        icosahedronPolar[i] = glm::dvec2(std::acos(icosahedron[i].z / len), std::atan(icosahedron[i].y/icosahedron[i].x));
-    }
-    
-    
-    
     int faceIndices[] = {
         0,2,1,  0,3,2,  0,4,3,  0,5,4,  0,1,5,
         1,2,7,  2,3,8,  3,4,9,  4,5,10, 5,1,6,
         1,7,6,  2,8,7,  3,9,8,  4,10,9, 5,6,10,
         6,7,11, 7,8,11, 8,9,11, 9,10,11,10,6,11,
     };
-    //generate 20 icosahedron faces
+    VertexIndex icosahedronVertices[12];
+    for (int i = 0; i<12;i++)
+    {
+        icosahedronVertices[i] = vertexPool.AddCorner(TerrainVertex(icosahedron[i]));
+    }
+    
+    //Splitting a face of level l moves a midpoint to at most (1 + |terrainHeight| * heightScale(l)) times the larger radius of the edge's ends, and |terrainHeight| <= 0.025,
+    //so the vertices below a face stay within the product of these factors over the deeper levels (and above the product of the (1 - ...) factors times the smaller radius).
+    //Every face's bounds depend on them, from the base faces on.
+    reliefFactor.assign(MAX_LOD + 2, 1);
+    sinkFactor.assign(MAX_LOD + 2, 1);
+    for (int level = MAX_LOD; level>=0; level--)
+    {
+        reliefFactor[level] = reliefFactor[level + 1] * (1 + static_cast<vfloat>(0.025) * heightScale(level));
+        sinkFactor[level] = sinkFactor[level + 1] * std::max(1 - static_cast<vfloat>(0.025) * heightScale(level), static_cast<vfloat>(0));
+    }
+    
+    //generate 20 icosahedron faces (five pool blocks of four)
+    FaceIndex block = NULL_FACE;
     for (int i = 0; i<20;i++)
     {
-        faces.push_back(Face(nullptr, icosahedron[faceIndices[3 * i + 0]],
-                             icosahedron[faceIndices[3 * i + 1]],
-                             icosahedron[faceIndices[3 * i + 2]],
-                             icosahedronPolar[faceIndices[3 * i + 0]],
-                             icosahedronPolar[faceIndices[3 * i + 1]],
-                             icosahedronPolar[faceIndices[3 * i + 2]]));
+        if (i%4==0) block = facePool.AllocateBlock();
+        FaceIndex index = block + i%4;
+        facePool[index] = Face(NULL_FACE, icosahedronVertices[faceIndices[3 * i + 0]],
+                               icosahedronVertices[faceIndices[3 * i + 1]],
+                               icosahedronVertices[faceIndices[3 * i + 2]], 0);
+        //nothing is known about the terrain yet, so the base faces are always worth splitting
+        facePool[index].error = static_cast<float>(Radius);
+        facePool[index].normal = glm::vec3(faceNormal(facePool[index]));
+        computeBounds(facePool[index]);
+        faces.push_back(index);
     }
+    
+    for (FaceIndex f : faces)
+    {
+        accumulateNormal(facePool[f], 1);
+        createPatch(f);
+    }
+    
+    //the ocean shell is the same icosahedron, subdivided evenly
+    std::vector<vvec3> baseTriangles;
+    for (int i = 0; i<60; i++)
+        baseTriangles.push_back(icosahedron[faceIndices[i]]);
+    ocean.SetBaseMesh(baseTriangles);
+
 }
 
 void Planet::Draw()
 {
-    
+    framesDrawn++;
     atmosphere.Position = static_cast<glm::vec3>(Position);
     setUniforms();
     time+=MainGame_SDL::ElapsedMilliseconds/10.;
@@ -585,32 +1171,117 @@ void Planet::Draw()
             break;
     }
     
-    size_t indsize, vertsize;
-    GetIndicesVerticesSizes(indsize, vertsize);
-    if (prevVerticesSize!=vertsize)
+    //pick up the newest mesh published by the update thread; the front buffer is only touched by this thread, so no lock is needed
+    mesh.Acquire();
+    const MeshSnapshot& snapshot = mesh.Front();
+    uploadSize = 0;
+    if (snapshot.generation!=uploadedGeneration)
     {
-        std::lock_guard<std::mutex> lock(renderMutex);
-        glBindBuffer(GL_ARRAY_BUFFER,VBO);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), &vertices[0], GL_DYNAMIC_DRAW);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indsize, &indices[0], GL_DYNAMIC_DRAW);
-        prevVerticesSize=(unsigned)vertsize;
+        uploadPatches(snapshot);
+        uploadedGeneration = snapshot.generation;
     }
 //    glDisable(GL_DEPTH_TEST);
 //    glManager.Programs[1].Use();
 //    atmosphere.Draw();
     
-    if (vertsize >0)
+    if (!drawCounts.empty())
     {
         glManager.Programs[0].Use();
 //        glEnable(GL_DEPTH_TEST);
-        std::lock_guard<std::mutex> lock(renderMutex);
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
-        glDrawElements(GL_TRIANGLES, (GLsizei)indices.size(), GL_UNSIGNED_INT, (void*)0);
+        //the terrain's waves are only drawn where it is the water, i.e. outside ocean mode
+        glManager.Programs[0].SetFloat("waveScale", snapshot.ocean ? 0.0f : 1.0f);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(), (GLsizei)drawCounts.size(), drawBaseVertices.data());
         glBindVertexArray(0);
     }
+    if (snapshot.ocean)
+    {
+        glManager.Programs[0].Use();
+        glManager.Programs[0].SetFloat("waveScale", 0.0f);
+        ocean.Draw(Radius + PlanetInfo.SeaLevel);
+    }
+}
+
+void Planet::uploadPatches(const MeshSnapshot& snapshot)
+{
+    //ranges of slots that were released (or reused for another patch) go back to the allocators
+    if (gpuPatches.size() < snapshot.patches.size()) gpuPatches.resize(snapshot.patches.size());
+    for (std::size_t i = 0; i<gpuPatches.size(); i++)
+    {
+        GPUPatch& gpuPatch = gpuPatches[i];
+        if (gpuPatch.mesh && (i>=snapshot.patches.size() || !snapshot.patches[i]))
+        {
+            vertexRanges.Free(gpuPatch.vertices);
+            indexRanges.Free(gpuPatch.indices);
+            gpuPatch = GPUPatch();
+        }
+    }
+    
+    //only visible patches whose mesh changed are sent; a patch keeps its ranges while its new mesh still fits into them
+    std::vector<unsigned int> changed;
+    for (unsigned int p : snapshot.visiblePatches)
+    {
+        GPUPatch& gpuPatch = gpuPatches[p];
+        const std::shared_ptr<const PatchMesh>& patch = snapshot.patches[p];
+        if (gpuPatch.mesh==patch) continue;
+        if (patch->vertices.size() > gpuPatch.vertices.capacity || patch->indices.size() > gpuPatch.indices.capacity)
+        {
+            vertexRanges.Free(gpuPatch.vertices);
+            indexRanges.Free(gpuPatch.indices);
+            gpuPatch.vertices = vertexRanges.Allocate(patch->vertices.size());
+            gpuPatch.indices = indexRanges.Allocate(patch->indices.size());
+        }
+        gpuPatch.mesh = patch;
+        changed.push_back(p);
+    }
+    
+    glBindBuffer(GL_ARRAY_BUFFER,VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
+    //Buffers are grown by (at least) doubling.  Reallocating a buffer discards its contents, so every patch in it is sent again.
+    bool grown = false;
+    if (vertexRanges.Size() > vertexBufferSize)
+    {
+        vertexBufferSize = std::max(vertexRanges.Size(), 2 * vertexBufferSize);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertexBufferSize, nullptr, GL_DYNAMIC_DRAW);
+        grown = true;
+    }
+    if (indexRanges.Size() > indexBufferSize)
+    {
+        indexBufferSize = std::max(indexRanges.Size(), 2 * indexBufferSize);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexBufferSize, nullptr, GL_DYNAMIC_DRAW);
+        grown = true;
+    }
+    if (grown)
+    {
+        changed.clear();
+        for (unsigned int i = 0; i<gpuPatches.size(); i++)
+            if (gpuPatches[i].mesh) changed.push_back(i);
+    }
+    
+    for (unsigned int p : changed)
+    {
+        const GPUPatch& gpuPatch = gpuPatches[p];
+        const PatchMesh& patch = *gpuPatch.mesh;
+        if (patch.indices.empty()) continue;
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(Vertex) * gpuPatch.vertices.offset, sizeof(Vertex) * patch.vertices.size(), patch.vertices.data());
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * gpuPatch.indices.offset, sizeof(unsigned int) * patch.indices.size(), patch.indices.data());
+        uploadSize += sizeof(Vertex) * patch.vertices.size() + sizeof(unsigned int) * patch.indices.size();
+    }
+    
+    //one draw per visible patch, each with its own base vertex since its indices are local
+    drawCounts.clear();
+    drawOffsets.clear();
+    drawBaseVertices.clear();
+    for (unsigned int p : snapshot.visiblePatches)
+    {
+        const GPUPatch& gpuPatch = gpuPatches[p];
+        if (gpuPatch.mesh->indices.empty()) continue;
+        drawCounts.push_back((GLsizei)gpuPatch.mesh->indices.size());
+        drawOffsets.push_back((GLvoid*)(sizeof(unsigned int) * gpuPatch.indices.offset));
+        drawBaseVertices.push_back((GLint)gpuPatch.vertices.offset);
+    }
 }
 
 void Planet::UpdatePhysics(double timeStep)
@@ -620,6 +1291,41 @@ void Planet::UpdatePhysics(double timeStep)
     RotationMatrixInv=glm::inverse(RotationMatrix);//glm::rotate(vmat4(), -Angle, glm::normalize(AngularVelocity));
     Angle+=static_cast<vfloat>(timeStep) * glm::length(AngularVelocity);
     player.Camera.PlanetRotation=Angle;
+    requestUpdate();
+}
+
+void Planet::requestUpdate()
+{
+    vvec3 camera = GetPlayerDisplacement();
+    //the distance that matters shrinks with altitude, since faces near the player get smaller
+    vfloat altitude = std::max(static_cast<vfloat>(glm::length(player.Position - Position)) - Radius, static_cast<vfloat>(1.0e-6));
+    vfloat threshold = UpdateDistanceThreshold * altitude;
+    auto now = std::chrono::high_resolution_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(updateMutex);
+        //Player::Velocity is per physics step and misses any other way of moving the player, so the velocity comes from the snapshots themselves
+        double elapsed = std::chrono::duration<double>(now - snapshotTime).count();
+        if (elapsed > 0)
+        {
+            //averaged over about a tenth of a second, so single uneven steps do not throw the prediction off
+            vfloat weight = static_cast<vfloat>(std::min(elapsed / 0.1, 1.0));
+            cameraVelocity += weight * ((camera - cameraSnapshot) / static_cast<vfloat>(elapsed) - cameraVelocity);
+        }
+        cameraSnapshot = camera;
+        snapshotTime = now;
+        //the running update is for a position too far behind to be worth finishing.
+        //Near the ground the altitude all but vanishes, so the distance is never less than the edge of a patch PATCH_DEPTH levels below the base faces (whose edges are about 1.05 radii):
+        //otherwise almost any movement would cancel, and every other update would be thrown away.
+        vfloat patchEdge = static_cast<vfloat>(1.0515) * Radius / static_cast<vfloat>(1 << PATCH_DEPTH);
+        vfloat restartDistance = UpdateRestartThreshold > 0 ? std::max(UpdateRestartThreshold * altitude, patchEdge) : 0;
+        if (cancellable && !updateCancelled && restartDistance > 0 && glm::length2(camera - updatingCamera) > restartDistance * restartDistance)
+            updateCancelled = true;
+        if (getPlayerDisplacementSquared(player) <= threshold * threshold && std::abs(Angle - lastUpdateAngle) <= UpdateAngleThreshold) return;
+        lastPlayerUpdatePosition = player.Position - Position;
+        lastUpdateAngle = Angle;
+        updateRequested = true;
+    }
+    updateCondition.notify_one();
 }
 
 glm::dvec3 Planet::polarCoords(glm::dvec3 vec)
@@ -20,57 +20,22 @@
 #include "PhysicsObject.h"
 #include <array>
 #include "RandomUtils.h"
+#include "Face.h"
+#include "VertexPool.h"
+#include "TaskPool.h"
+#include "TripleBuffer.h"
+#include "RangeAllocator.h"
+#include "TerrainNoise.h"
+#include "HeightCache.h"
+#include "TerrainTileCache.h"
+#include "LODMetric.h"
+#include "OceanShell.h"
+#include "EpochManager.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <chrono>
 
-///Representation of a triangular face on CPU side of program,
-///represents a single node in the face tree
-struct Face
-{
-    ///vertices of triangle
-    std::array<vvec3, 3> vertices;
-    //For position comparisons
-    //Polar coordinates are stored in double precision for better floating point comparisons (this should be temporary)
-    std::array<glm::dvec2, 3> polarCoords;
-    
-    
-    std::array<int,3> indices;
-    
-    ///pointers to children in tree structure
-    std::array<Face*, 4> children;
-    
-    Face* parent;
-    
-    inline bool AllChildrenNull() { return children[0]==nullptr && children[1]==nullptr && children[2]==nullptr && children[3]==nullptr; }
-    inline bool AnyChildrenNull() { return children[0]==nullptr || children[1]==nullptr || children[2]==nullptr || children[3]==nullptr; }
-    
-    ///depth in tree
-    unsigned int level;
-    Face() : level(0) {}
-    ~Face()
-    {
-    }
-    
-    Face(Face* _parent, vvec3 _v1, vvec3 _v2, vvec3 _v3, glm::dvec2 p1, glm::dvec2 p2, glm::dvec2 p3) : parent(_parent), vertices{_v1,_v2,_v3}, polarCoords{p1,p2,p3}, indices{-1,-1,-1},level(0), children{nullptr,nullptr,nullptr,nullptr}
-    {
-        
-    }
-    Face(Face* _parent, vvec3 _v1, vvec3 _v2, vvec3 _v3, glm::dvec2 p1, glm::dvec2 p2, glm::dvec2 p3, unsigned int _level) : parent(_parent), vertices{_v1,_v2,_v3}, polarCoords{p1,p2,p3}, indices{-1,-1,-1}, level(_level), children{nullptr,nullptr,nullptr,nullptr}
-    {
-        
-    }
-    ///copy constructor
-    Face(const Face& face) : vertices(face.vertices), indices(face.indices), parent(face.parent), level(face.level), children(face.children)  {}
-    ///returns the normal vector of the face (used for lighting calculations)
-    inline vvec3 GetNormal()
-    {
-        return glm::normalize(glm::cross(vertices[0]-vertices[1], vertices[0]-vertices[2]));
-    }
-    
-    inline vvec3 GetCenter()
-    {
-        return (vertices[0] + vertices[1] + vertices[2])/(static_cast<vfloat>(3));
-    }
-    
-};
 ///Representation of a single vertex for communication with GPU
 ///recursiveUpdate function interops between two representations of vertex data (convenient Face & rendering Vertex representations)
 ///Contains position as well as normal vectors
@@ -78,10 +43,9 @@ struct Face
 struct Vertex
 {
     vfloat x,y,z;
-    vfloat tx,ty; // texture coordinates
     vfloat nx, ny, nz;
     
-    Vertex(vvec3 pos, vvec2 uv, vvec3 normal) : x(pos.x), y(pos.y), z(pos.z), tx(uv.x), ty(uv.y),
+    Vertex(vvec3 pos, vvec3 normal) : x(pos.x), y(pos.y), z(pos.z),
     nx(normal.x), ny(normal.y), nz(normal.z)
     {}
     
@@ -90,6 +54,27 @@ struct Vertex
     inline vvec3 GetPosition() { return vvec3(x,y,z); }
 };
 
+///Mesh of one patch (see Planet::PATCH_DEPTH).  Indices refer to the patch's own vertices.
+struct PatchMesh
+{
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+};
+
+///One complete version of the planet mesh, as handed from the update thread to the render thread
+struct MeshSnapshot
+{
+    ///patch table: one mesh per patch slot (null for unused slots).  Patches that did not change since the previous version share its mesh.
+    std::vector<std::shared_ptr<const PatchMesh>> patches;
+    ///slots of the patches within the horizon
+    std::vector<unsigned int> visiblePatches;
+    ///incremented for every published mesh; 0 means no mesh has been built yet
+    unsigned long generation;
+    ///whether the mesh was built for ocean mode (leaving out the faces under water), so the ocean shell has to be drawn with it
+    bool ocean;
+    MeshSnapshot() : generation(0), ocean(false) {}
+};
+
 //TODO: implement vertex indexing
 
 //reference on subdivided icosahedrons (the geodesic sphere):
@@ -129,10 +114,36 @@ public:
     ///number in [0,1] reflecting how fractal-like the terrain is (larger values lead to more variation at smaller scales)
     const float TERRAIN_REGULARITY;
     
-    ///Number of levels of detail (impacts rendering performance)
+    ///Number of levels of detail of DistanceLODMetric (impacts rendering performance)
     ///Multiplies average # of vertices by 4^N
     const int LOD_MULTIPLIER=6;
     const int MAX_LOD = 25;
+    ///The mesh is extracted and culled in patches.  Every base face, and every split face at a multiple of PATCH_DEPTH levels, roots a patch,
+    ///which holds the leaves below it down to (and including) the next such level.  A patch therefore never has more than 4^PATCH_DEPTH triangles.
+    const int PATCH_DEPTH = 4;
+    ///Upper bound on the number of terrain triangles (leaf faces).  Once it is reached, a face is only split after a less important one has been merged.
+    std::size_t TriangleBudget = 1 << 20;
+    ///Milliseconds one update may spend splitting and merging faces; whatever is left over is picked up by the next update
+    double LODTimeBudget = 10.0;
+    ///How far ahead, in update latencies, the camera's position is predicted from its velocity.  Leaves that the metric would split at the predicted position are split too,
+    ///after every leaf that needs splitting now, so the terrain ahead is already refined when a fast camera gets there.  0 disables the prediction.
+    vfloat SpeculationLookahead = 2;
+    ///Progressive refinement: one update splits a face at most this many levels below the leaves it started with, then publishes its mesh, and the next update goes on from there.
+    ///After a jump, a coarse mesh thus appears after one short update however deep the terrain ends up, and finer ones follow every update.  0 refines as deep as the time budget allows.
+    unsigned int ProgressiveLevels = 4;
+    ///The update thread sleeps until the player has moved by this fraction of their altitude since the last update...
+    vfloat UpdateDistanceThreshold = 0.01;
+    ///...or the planet has rotated by this many radians
+    vfloat UpdateAngleThreshold = 0.001;
+    ///An update still running when the player has moved by this fraction of their altitude (but at least the edge length of a patch below a base face) from the position it was started for is cancelled:
+    ///it stops at its next check (between batches of splits or of extracted patches), publishes nothing, and the next update starts from the new position.
+    ///An update that follows a cancelled one always runs to the end, so a camera that keeps moving this fast still gets a mesh.  0 disables cancelling.
+    vfloat UpdateRestartThreshold = 0.5;
+    ///Number of faces whose midpoint noise is kept after they are combined, so that splitting them again does not evaluate it again (0 disables the cache)
+    std::size_t HeightCacheCapacity = 1 << 16;
+    ///Faces whose geometric error (see Face::error) is below this fraction of the radius are not split, whatever the LOD metric says, and their children are merged first.
+    ///The error of a subtree shrinks with each level, so the relief below such a face stays within a small multiple of it.
+    vfloat FlatnessTolerance = 1.0e-8;
     
     enum class RotationMode
     {
@@ -150,42 +161,176 @@ public:
     ///Seed used for random number generator (RNG needs to be updates)
     const vfloat SEED;
     ///Initialization of planet
-    Planet(int planetIndex, glm::vec3 pos, vfloat radius, double mass, vfloat seed, Player& _player, GLManager& _glManager, float terrainRegularity);
+    Planet(int planetIndex, glm::vec3 pos, vfloat radius, double mass, vfloat seed, Player& _player, GLManager& _glManager, TaskPool& _taskPool, float terrainRegularity);
     //De-initialization of planet (destruction of GL objects)
     ~Planet();
     ///Perform subdivisions/combinations accordingly, update vertex buffers
     void Update();
     ///Render planet with Vertex Buffer Object/Vertex Array Object
     void Draw();
-    ///Terrain generation function in cartesion coordinates (spherically-symmetric)
-    inline double terrainNoise(double theta, double phi);
-    inline double terrainNoise(glm::dvec2 polarCoords);
     void UpdatePhysics(double timeStep);
     
     
     //uses the space partitioning of the planet's surface to perform efficient collision detection between points and surface
     void CheckCollision(PhysicsObject* object);
+    ///Memory statistics of the face tree (live/peak nodes and reserved bytes)
+    inline FacePool::Stats GetFacePoolStats() { return facePool.GetStats(); }
+    ///Memory statistics of the vertices referenced by the face tree
+    inline VertexPool::Stats GetVertexPoolStats() { return vertexPool.GetStats(); }
+    ///Hit rate and memory of the midpoint noise cache
+    inline HeightCache::Stats GetHeightCacheStats() { return heightCache.GetStats(); }
+    ///Keeps the midpoint noise in the file at path (of at most maxBytes) across sessions as well, see TerrainTileCache; an empty path disables it.
+    ///The file is opened by the next update.
+    void SetTileCache(const std::string& path, std::size_t maxBytes = std::size_t(64) << 20);
+    TerrainTileCache::Stats GetTileCacheStats();
+    ///Distance from the centre to the terrain in the given direction (in the planet's rotating frame), as far as the terrain is refined at the moment.
+    ///May be called from any thread while the update thread refines the terrain.
+    vfloat GetSurfaceRadius(const vvec3& direction);
+    ///Replaces the metric deciding which faces are split (a ScreenSpaceErrorMetric by default).  The next update starts using it.
+    void SetLODMetric(std::shared_ptr<LODMetric> metric);
+    ///Number of triangles (leaf faces) in the face tree
+    inline std::size_t GetTriangleCount() const { return triangleCount; }
+    ///Number of leaves that the LOD metric wanted split at the last update but that were too flat (see FlatnessTolerance).
+    ///Each would have become four triangles, so at least three times as many triangles were saved.
+    inline std::size_t GetFlatLeafCount() const { return flatLeafCount; }
+    ///Number of leaves left out of the mesh at the last update because they are entirely under water (in ocean mode)
+    inline std::size_t GetSubmergedLeafCount() const { return submergedLeafCount; }
+    ///Bytes of vertex and index data sent to the GPU by the last Draw()
+    inline std::size_t GetUploadSize() const { return uploadSize; }
+    
+    ///Time spent in each phase of one update (in milliseconds) and the size of the resulting mesh
+    struct UpdateTimings
+    {
+        ///splitting and merging faces
+        double lod;
+        ///culling of the patches
+        double culling;
+        ///re-extracting the dirty patches
+        double extraction;
+        ///handing the new mesh to the render thread
+        double publish;
+        std::size_t triangles;
+        ///see GetFlatLeafCount()
+        std::size_t flatLeaves;
+        ///see GetSubmergedLeafCount()
+        std::size_t submergedLeaves;
+        ///triangles in the visible patches, i.e. the size of the mesh that is drawn
+        std::size_t meshTriangles;
+        std::size_t extractedPatches;
+        std::size_t visiblePatches;
+        ///patches whose bounds were tested (the others kept their last result)
+        std::size_t cullTests;
+        ///whether the update was cancelled (see UpdateRestartThreshold) before publishing a mesh
+        bool cancelled;
+        UpdateTimings() : lod(0), culling(0), extraction(0), publish(0), triangles(0), flatLeaves(0), submergedLeaves(0), meshTriangles(0), extractedPatches(0), visiblePatches(0), cullTests(0), cancelled(false) {}
+    };
+    ///When set, the timings of every update are kept until TakeUpdateTimings() is called.  Off by default, since nothing else empties the list.
+    std::atomic<bool> RecordTimings;
+    ///Ocean mode: the sea is drawn as a separate sphere at sea level (see OceanShell), and terrain faces that are entirely under water are neither split nor drawn.
+    ///Off by default; a change takes effect at the next update.
+    std::atomic<bool> OceanMode;
+    ///subdivisions of the icosahedron the ocean shell is made of (20 * 4^N triangles)
+    const int OCEAN_SUBDIVISIONS = 6;
+    ///Hands out (and forgets) the timings recorded since the last call
+    std::vector<UpdateTimings> TakeUpdateTimings();
+    ///Frames drawn since the planet was created, as far as the updates have looked at them
+    struct LODFrameStats
+    {
+        std::size_t Frames;
+        ///frames drawn while some leaf was well coarser than the camera at the next update needed (see GetLODFrameStats())
+        std::size_t InsufficientFrames;
+        ///the share of the leaves that were well coarser than the camera needed, summed over the frames: divided by Frames, how much of the mesh was insufficient on average
+        double InsufficientLeafFrames;
+    };
+    ///Every update counts the frames drawn since the previous one as insufficient if it finds leaves whose split priority at the current camera position exceeds INSUFFICIENT_PRIORITY,
+    ///i.e. if the mesh those frames were drawn with was clearly coarser than the camera called for by the time the update looked.
+    LODFrameStats GetLODFrameStats() const;
 private:
     
     //reference angle for icosahedron vertices in radians -- used to calculate Cartesian coordinates of vertices
     const double icotheta = 26.56505117707799 * M_PI / 180.0;
     
     
+    ///player position (relative to the planet) and planet angle that the last update was performed for
     glm::dvec3 lastPlayerUpdatePosition;
-    
-    inline vfloat getPlayerDisplacementSquared(const Player& player) const { return glm::length2(player.Position - lastPlayerUpdatePosition); }
+    vfloat lastUpdateAngle;
+    
+    inline vfloat getPlayerDisplacementSquared(const Player& player) const { return glm::length2(player.Position - Position - lastPlayerUpdatePosition); }
+    
+    //Wake-up of the update thread.  The main thread snapshots the camera every physics step and signals updateCondition once the player or the planet has moved enough to matter.
+    std::mutex updateMutex;
+    std::condition_variable updateCondition;
+    bool updateRequested;
+    ///camera position in the planet's (rotating) frame, as of the latest physics step
+    vvec3 cameraSnapshot;
+    ///set by updateLOD when it ran out of time with work left, so the next update starts without waiting for the camera
+    bool refinementPending;
+    ///camera position the running update was started for, and whether it may still be cancelled (see UpdateRestartThreshold)
+    vvec3 updatingCamera;
+    bool cancellable;
+    ///camera velocity in the planet's frame (per second), smoothed over the physics steps
+    vvec3 cameraVelocity;
+    std::chrono::high_resolution_clock::time_point snapshotTime;
+    ///called on the main thread after the planet has moved
+    void requestUpdate();
     
     const std::string performanceOutput;
     
-    void recursiveGetRootFaces(std::vector<Face*>& rootFaces, Face* f, Player& player);
-    void getRootFaces(std::vector<Face*>& rootFaces, Player& player);
-    
-    
-    //Planet faces.  This array only contains the base icosahedron vertices, and deeper faces are stored on the heap (in a tree structure).  These are not directly transferred to the GPU
-    std::vector<Face> faces;
-    //Array of vertices.  This array is generated every time the geometry is updated (perhaps this can be optimized) and is copied directly to the GPU.
-    std::vector<Vertex> vertices;
-    std::vector<unsigned int> indices;
+    ///collects the leaves of the patch rooted at f, leaving out subtrees that are entirely under water (see isSubmerged)
+    void recursiveGetRootFaces(std::vector<FaceIndex>& rootFaces, FaceIndex f);
+    
+    
+    //Backing storage for every node of the face tree, and for the vertices they reference.
+    FacePool facePool;
+    VertexPool vertexPool;
+    //Face blocks and vertices are not freed when their faces are combined, but retired until no reader on another thread that may still see them (GetSurfaceRadius) is left.
+    //Only the update thread combines faces, so the lists need no lock; its own readers (evaluation, culling, extraction) never overlap a combination and need no epoch.
+    EpochManager epochs;
+    RetireList<FaceIndex> retiredFaces;
+    RetireList<VertexIndex> retiredVertices;
+    ///frees whatever was retired before the oldest epoch a reader is still in (update thread)
+    void reclaimRetired();
+    //Planet faces.  This array only contains the indices of the base icosahedron faces; they and all deeper faces are stored in facePool (in a tree structure).  These are not directly transferred to the GPU
+    std::vector<FaceIndex> faces;
+    //Patch table (update thread): the root face and current mesh of every patch slot, and the slots free for reuse.
+    //Only patches on the dirty list are extracted again.
+    std::vector<FaceIndex> patchRoots;
+    std::vector<std::shared_ptr<const PatchMesh>> patchMeshes;
+    ///the patches whose roots are PATCH_DEPTH levels below each patch's root, so that culling can skip whole subtrees of patches
+    std::vector<std::vector<PatchIndex>> patchChildren;
+    std::vector<PatchIndex> freePatches;
+    std::vector<FaceIndex> dirtyPatches;
+    std::vector<unsigned int> visiblePatches;
+    //Vertex and index arrays.  These are generated every time the geometry is updated and are copied directly to the GPU.
+    //The update thread builds each version in the back buffer and publishes it; the render thread uploads whichever version is newest when it draws.
+    TripleBuffer<MeshSnapshot> mesh;
+    ///generation of the last mesh published (update thread)
+    unsigned long meshGeneration;
+    ///generation of the mesh currently in the GPU buffers (render thread)
+    unsigned long uploadedGeneration;
+    //GPU patch table (render thread).  Every patch slot that has been drawn keeps its own range of the vertex and index buffers, so only patches whose mesh changed are sent to the GPU again.
+    //Patches that leave the horizon stay in their ranges, and are only sent again once they change.
+    struct GPUPatch
+    {
+        ///the mesh in the ranges (kept so that the ranges can be refilled when the buffers grow)
+        std::shared_ptr<const PatchMesh> mesh;
+        RangeAllocator::Range vertices;
+        RangeAllocator::Range indices;
+    };
+    std::vector<GPUPatch> gpuPatches;
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+    ///current sizes of the GPU buffers, in vertices and indices
+    std::size_t vertexBufferSize;
+    std::size_t indexBufferSize;
+    ///bytes sent to the GPU by the last Draw()
+    std::size_t uploadSize;
+    ///Brings the GPU patch table up to date with a mesh version and rebuilds the draw arguments
+    void uploadPatches(const MeshSnapshot& snapshot);
+    ///arguments of the multi-draw call covering the visible patches (render thread)
+    std::vector<GLsizei> drawCounts;
+    std::vector<GLvoid*> drawOffsets;
+    std::vector<GLint> drawBaseVertices;
     std::thread updateThread;
     
     //VBO=Vertex Buffer Object.  This OpenGL API object contains functionality for sending arrays of vertices (with arbitrary attributes) to the GPU.  The attributes of each vertex can be referenced in the vertex shader.
@@ -196,54 +341,213 @@ private:
     
     GLManager& glManager;
     Player& player;
+    ///shared with the other planets; runs the per-root subtree traversals of each update
+    TaskPool& taskPool;
     std::mutex renderMutex;
     
     PlanetAtmosphere atmosphere;
     inline glm::dvec3 polarCoords(glm::dvec3 vec);
     
-    inline bool inHorizon(vvec3 vertex);
-    inline bool inHorizon(Face& face);
-    
     //TODO: implement vertex indexing for faster rendering and less CPU-GPU communcation
     
-    ///This function, which accepts a face and a boolean-valued function of the player's position and that face, checks whether a face is ready to be subdivided (in this case, close enough to the camera) and performs the subdivision.  The function argument of this method makes it more modular; the function used to CHECK whether to subdivide the face is external.
-    ///takes a function of the player information and the current face
-    bool trySubdivide(Face* face, Player& player);
-    ///Like trySubdivide, this function accepts a face and a function of the face and the player.  Instead of subdividing the face if it meets the function's criteria, it instead COMBINES the face's children.  Also like trySubdivide, this function is heavily reliant on the tree structure of the faces (one may now see why it was chosen over a one-dimensional resizeable array).
-    bool tryCombine(Face* face, Player& player);
-    ///This function is a pseudorandom number generator of two arguments (in this case the polar and azimuthal angles of the vertex in spherical coordinates)
-    inline double randvfloat(double seedx, double seedy);
-    inline double randvfloat(glm::dvec2 vec);
-    ///converts a Cartesian vector to a two-dimesnional polar-azimuthal vector (ignores radius)
-    inline glm::dvec2 sphericalCoordinates(vvec3 pos);
+    ///A face waiting in the split or merge queue.  The face's level and parent are kept to recognize entries made stale by earlier splits and merges of the same update.
+    struct LODCandidate
+    {
+        vfloat priority;
+        FaceIndex face;
+        FaceIndex parent;
+        unsigned int level;
+        ///number of splits in this update that led to the face (0 for the leaves found by the evaluation pass), see ProgressiveLevels
+        unsigned int descent;
+        LODCandidate(vfloat _priority, FaceIndex _face, const Face& f, unsigned int _descent = 0) : priority(_priority), face(_face), parent(f.parent), level(f.level), descent(_descent) {}
+        inline bool operator<(const LODCandidate& other) const { return priority < other.priority; }
+        inline bool operator>(const LODCandidate& other) const { return priority > other.priority; }
+    };
+    ///Split and merge candidates gathered from the face tree
+    struct LODCandidates
+    {
+        std::vector<LODCandidate> splits;
+        std::vector<LODCandidate> merges;
+        std::size_t leaves;
+        ///leaves held back by isFlat()
+        std::size_t flatLeaves;
+        ///leaves held back by isSubmerged()
+        std::size_t submergedLeaves;
+        ///leaves whose split priority at the current camera position (rather than at the predicted one) exceeds INSUFFICIENT_PRIORITY
+        std::size_t insufficientLeaves;
+        LODCandidates() : leaves(0), flatLeaves(0), submergedLeaves(0), insufficientLeaves(0) {}
+    };
+    ///A leaf is split while its split priority exceeds 1, and a face's children are merged once its merge priority drops to MERGE_PRIORITY.
+    ///The gap between the two keeps faces close to the threshold from being split and merged on alternate updates.
+    const vfloat MERGE_PRIORITY = 0.5;
+    ///A leaf only counts as too coarse for the frames drawn with it (see GetLODFrameStats()) once its split priority exceeds this.
+    ///Leaves just past 1 are nearly always about, at the triangle budget or after any small camera move, so counting them would call every frame insufficient.
+    const vfloat INSUFFICIENT_PRIORITY = 2;
+    ///number of queued splits performed in parallel at once
+    const std::size_t SPLIT_BATCH = 64;
+    ///number of dirty patches extracted between checks for cancellation
+    const std::size_t EXTRACTION_SLICE = 64;
+    ///metric used by the current LOD pass, and the one SetLODMetric asked for
+    std::shared_ptr<LODMetric> lodMetric;
+    std::shared_ptr<LODMetric> requestedLODMetric;
+    std::mutex lodMetricMutex;
+    ///OceanMode as seen by the update thread: changes of OceanMode are applied at the start of an update, so that one update works with one value
+    bool oceanMode;
+    ///ocean mode of the last published snapshot (update thread); mesh.Back() is a recycled slot holding an older version, so it cannot tell
+    bool publishedOcean;
+    ///the sea in ocean mode
+    OceanShell ocean;
+    ///reliefFactor[level]: how far the radius of any vertex below a face of the given level can exceed that of the face's highest vertex (as a factor)
+    std::vector<vfloat> reliefFactor;
+    ///sinkFactor[level]: the same for how far it can fall below that of the face's lowest vertex
+    std::vector<vfloat> sinkFactor;
+    ///the face's SubdivisionAddress, spelled out by the walk up to its base face
+    SubdivisionAddress addressOf(FaceIndex face) const;
+    ///Sets the bounding sphere of a new face from its vertices, and starts its normal cone at the face's own normal
+    void computeBounds(Face& f) const;
+    ///Widens the normal cones of a face that was just split and of its ancestors to contain the children's normals
+    void widenCones(FaceIndex face);
+    
+    ///What the culling tests need from the camera, computed once per pass
+    struct CullingVolume
+    {
+        vvec3 camera;
+        vfloat horizonDist;
+        ///planes bounding the view (left, right, bottom, top, near), pointing inwards; only tested with CULL_FRUSTUM
+        std::array<vvec4, 5> planes;
+    };
+    ///Tests of cullFace.  A subtree that passes a test entirely is not tested again below, so the mask shrinks on the way down.
+    enum : unsigned int
+    {
+        CULL_HORIZON = 1,
+        CULL_FACING = 2,
+        ///one bit per frustum plane, from this one up
+        CULL_FRUSTUM = 4,
+        CULL_ALL = 0x7f
+    };
+    ///False if nothing below the face can be seen (beyond the horizon, facing away or outside a plane); clears the bits of the tests that everything below it passes.
+    ///margin is lowered to how far the camera (or the horizon distance, or a plane) would have to move for the outcome or the cleared bits to change.
+    inline bool cullFace(const Face& f, const CullingVolume& volume, unsigned int& mask, vfloat& margin) const;
+    ///Collects the visible patches in the tree of patches below patch (testing the bounds of their roots hierarchically) and the distance to the nearest of them; tests counts the patches actually tested
+    void cullPatches(PatchIndex patch, const CullingVolume& volume, unsigned int mask, std::vector<unsigned int>& visible, vfloat& nearest, std::size_t& tests);
+    ///Result of the last test of a patch, kept until the camera has moved far enough to change it
+    struct PatchCullState
+    {
+        ///values of cullDistance when the patch was tested, and at which the result runs out
+        double testedAt, retestAt;
+        ///distance from the camera to the bounds at the test
+        vfloat distance;
+        unsigned int testedMask, passedMask;
+        bool visible;
+        PatchCullState() : testedAt(0), retestAt(0), distance(0), testedMask(0), passedMask(0), visible(true) {}
+    };
+    std::vector<PatchCullState> patchCulling;
+    ///distance travelled by the camera, plus the change of the horizon distance, over all culling passes so far (in double precision, since it only grows)
+    double cullDistance;
+    vvec3 lastCullCamera;
+    vfloat lastHorizonDist;
+    ///whether, in ocean mode, the face and everything that can ever be split off it is below sea level
+    inline bool isSubmerged(const Face& f) const;
+    ///whether the face's relief is too small to be worth splitting (see FlatnessTolerance)
+    inline bool isFlat(const Face& f) const { return f.error < FlatnessTolerance * Radius; }
+    ///the metric's priority at the face's farthest vertex
+    inline vfloat splitPriority(const Face& f, const vvec3& camera) const;
+    ///the metric's priority at the face's nearest vertex, from the current or (while speculating) the predicted camera position, whichever is closer
+    inline vfloat mergePriority(const Face& f, const vvec3& camera) const;
+    ///Priority a leaf is queued for splitting with: its split priority if that exceeds 1, otherwise a priority in (MERGE_PRIORITY,1) if it needs splitting
+    ///at the predicted camera position, otherwise 0.  Splits for the prediction thus come after every split needed now, and never pay for themselves with a merge.
+    inline vfloat queuedSplitPriority(const Face& f, const vvec3& camera) const;
+    ///camera position predicted for the end of the update ahead, see SpeculationLookahead; only used while speculating is set
+    vvec3 predictedCamera;
+    bool speculating;
+    ///smoothed time (in seconds) from a camera snapshot until the mesh for it is published
+    double updateLatency;
+    bool isSplittable(const LODCandidate& c) const;
+    bool isMergeable(const LODCandidate& c) const;
+    ///Splits and merges faces in order of priority (ROAM-style) within the triangle and time budgets.  Returns whether the tree changed.
+    bool updateLOD(const vvec3& camera);
+    ///coherent noise the terrain is built from (seeded by SEED)
+    TerrainNoise noise;
+    ///noise of recently combined faces (see HeightCacheCapacity)
+    HeightCache heightCache;
+    ///noise of faces split in this or earlier sessions (see SetTileCache); checked after heightCache
+    TerrainTileCache tileCache;
+    ///settings of SetTileCache, picked up by updateTileCache() on the update thread; the mutex also keeps GetTileCacheStats() from reading a cache that is being reopened
+    std::string tileCachePath;
+    std::size_t tileCacheMaxBytes;
+    std::mutex tileCacheMutex;
+    ///(re)opens the tile cache if SetTileCache changed its settings
+    void updateTileCache();
+    ///height scale of the midpoints generated by splitting a face of the given level
+    inline vfloat heightScale(unsigned int level) const;
+    ///Terrain height (relative to the radius, before the level's height scale) for a noise value in [-1,1]
+    inline double terrainHeight(double noiseValue) const;
+    ///builds the displaced midpoint of the edge between two vertex positions
+    ///direction is the normalized midpoint and noiseValue the noise there; fac is the height scale of the level being split
+    TerrainVertex generateMidpoint(const vvec3& a, const vvec3& b, const vvec3& direction, float noiseValue, vfloat fac) const;
     ///construct base icosahedron
     void buildBaseMesh();
     ///initialize VBO and VAO
     void generateBuffers();
-    ///Reconstruct vertex array and send vertices to GPU
-    void updateVBO(Player& player);
+    ///Re-extract the dirty patches and publish the new mesh (if it changed) for the render thread to send to the GPU
+    void updateVBO(Player& player, const vvec3& camera, UpdateTimings& timings);
+    ///timings of the updates since the last TakeUpdateTimings() call (see RecordTimings)
+    std::vector<UpdateTimings> updateTimings;
+    std::mutex timingsMutex;
+    ///Builds the mesh of the patch below root.  Only reads the face tree, so several patches may be extracted at once.
+    std::shared_ptr<const PatchMesh> extractPatch(FaceIndex root, const CullingVolume& volume);
     ///Append vertices deepest in the tree to vertex array to be sent to GPU
-    ///also calculates the player's minimum distance to the planet surface
-    void recursiveUpdate(Face& face, unsigned int index1, unsigned int index2, unsigned int index3, Player& player, std::vector<Vertex>& newVertices, std::vector<unsigned int>& newIndices);
-    ///Perform trySubdivide by recursively traversing tree
-    bool recursiveSubdivide(Face* face, Player& player);
-    ///Perform tryCombine by recursively traversing tree
-    bool recursiveCombine(Face* face, Player& player);
+    ///faces are culled against the volume, skipping the tests left out of mask
+    void recursiveUpdate(FaceIndex face, unsigned int index1, unsigned int index2, unsigned int index3, const CullingVolume& volume, unsigned int mask, std::vector<Vertex>& newVertices, std::vector<unsigned int>& newIndices);
+    ///Gather the split and merge candidates of a subtree into the given (task-local) candidate lists
+    ///child subtrees are handed to the task pool (under the given group) whenever it has idle workers; those report to the shared lists
+    void recursiveEvaluate(FaceIndex face, const vvec3& camera, LODCandidates& candidates, LODCandidates& shared, TaskPool::TaskGroup& group);
+    ///Evaluates a subtree into its own candidate lists and appends them to the shared ones
+    void evaluateSubtree(FaceIndex face, const vvec3& camera, LODCandidates& shared, TaskPool::TaskGroup& group);
+    ///Divides a leaf face into four children, creating any edge midpoints its neighbours have not created yet
+    void subdivideFace(FaceIndex face);
+    ///Moves a split face's contribution to the vertex normal sums over to its children (sign 1), or back to the face before it is combined (sign -1)
+    void transferNormals(FaceIndex face, vfloat sign);
+    inline void accumulateNormal(const Face& f, vfloat weight);
+    ///Flags the patches of every leaf using the corners or the edge midpoints of a split face, whose normal sums a split or combination of it changes.
+    ///Vertices on a patch's border are baked into the neighbouring patches as well, which would otherwise keep the old normal.
+    void markPatchesSharing(FaceIndex face);
+    ///Flags the patches of every leaf with the vertex as a corner; face is any face with it as a corner
+    void markPatchesUsing(VertexIndex vertex, FaceIndex face);
+    ///The face of the same level across the edge between two of its corners, or NULL_FACE if the other side is not split that deep
+    FaceIndex neighbourAcross(FaceIndex face, VertexIndex a, VertexIndex b) const;
+    ///root of the patch that the leaves below face belong to
+    inline FaceIndex patchOf(FaceIndex face) const;
+    ///Flags a patch root for extraction
+    inline void markDirty(FaceIndex root);
+    void createPatch(FaceIndex root);
+    void releasePatch(FaceIndex root);
     //Simple function which deletes children vertices in order to combine the face.
-    void combineFace(Face* face);
+    void combineFace(FaceIndex face);
     void setUniforms();
     ///number of ticks (executions of Update()) since start; used in rotation of sun
     float time;
-    bool closed;
-    bool subdivided;
-    unsigned int prevVerticesSize;
-    
-    
-    inline bool faceInView(const Face& f);
+    std::atomic<bool> closed;
+    ///set by requestUpdate() to cancel the running update; checked wherever closed is
+    std::atomic<bool> updateCancelled;
+    inline bool interrupted() const { return closed || updateCancelled; }
+    std::atomic<std::size_t> triangleCount;
+    std::atomic<std::size_t> flatLeafCount;
+    std::atomic<std::size_t> submergedLeafCount;
+    std::mutex candidateMutex;
+    ///frames drawn so far (see GetLODFrameStats()); the others are only written by the update thread
+    std::atomic<std::size_t> framesDrawn;
+    std::atomic<std::size_t> framesEvaluated;
+    std::atomic<std::size_t> insufficientFrames;
+    std::atomic<double> insufficientLeafFrames;
+    
+    
+    inline const vvec3& vertexPosition(VertexIndex v) const { return vertexPool[v].position; }
+    ///computes the normal vector of the face from its vertices (used for lighting calculations; faces keep it in Face::normal)
+    inline vvec3 faceNormal(const Face& f) const;
+    inline vvec3 faceCenter(const Face& f) const;
     
     inline vvec3 GetPlayerDisplacement();
-    
-    inline void GetIndicesVerticesSizes(size_t& indsize, size_t& vertsize);
 };
 
 vvec3 Planet::GetPlayerDisplacement()
@@ -252,55 +556,136 @@ vvec3 Planet::GetPlayerDisplacement()
     return vmat3(RotationMatrixInv) * (player.Camera.position- static_cast<vvec3>(Position));//*glm::inverse(vmat3(RotationMatrix));
 }
 
-void Planet::GetIndicesVerticesSizes(size_t& indsize, size_t& vertsize)
+void Planet::accumulateNormal(const Face& f, vfloat weight)
 {
-    std::lock_guard<std::mutex> lock(renderMutex);
-    vertsize = vertices.size();
-    indsize = indices.size();
+    vvec3 normal = vvec3(f.normal) * weight;
+    for (VertexIndex v : f.vertices) vertexPool[v].normal += normal;
 }
 
-bool Planet::inHorizon(vvec3 vertex)
+FaceIndex Planet::patchOf(FaceIndex index) const
 {
-    vfloat playerHeight = glm::length(GetPlayerDisplacement())-1.0;
-    //refer to Wikipedia for formula for horizon distance
-    vfloat horizonDist2 = 2*Radius * playerHeight + playerHeight * playerHeight;
-    vfloat dist2 = glm::length2(GetPlayerDisplacement() - vertex);
-    return (std::max(horizonDist2, static_cast<vfloat>(0.05)) > dist2);
+    const Face& face = facePool[index];
+    if (face.patch!=NULL_PATCH) return index;
+    index = face.parent;
+    while (facePool[index].level % PATCH_DEPTH != 0) index = facePool[index].parent;
+    return index;
 }
 
-bool Planet::inHorizon(Face& face)
+void Planet::markDirty(FaceIndex root)
 {
-    return inHorizon(face.vertices[0]) || inHorizon(face.vertices[1]) || inHorizon(face.vertices[2]) || inHorizon(face.GetCenter());
+    Face& face = facePool[root];
+    if (face.dirty) return;
+    face.dirty = true;
+    dirtyPatches.push_back(root);
 }
 
+bool Planet::cullFace(const Face& f, const CullingVolume& volume, unsigned int& mask, vfloat& margin) const
+{
+    vvec3 center = vvec3(f.boundsCenter);
+    vfloat radius = f.boundsRadius;
+    vvec3 toCenter = center - volume.camera;
+    vfloat dist = glm::length(toCenter);
+    //Each test compares two signed distances with 0 (one deciding that nothing is visible, one that everything is), and each changes at most as fast as the camera moves.
+    if (mask & CULL_HORIZON)
+    {
+        vfloat beyond = dist - radius - volume.horizonDist, within = volume.horizonDist - dist - radius;
+        if (beyond >= 0) { margin = std::min(margin, beyond); return false; }
+        if (within > 0) mask &= ~CULL_HORIZON;
+        margin = std::min(margin, std::min(-beyond, std::abs(within)));
+    }
+    //Every normal n in the cone is within angle a of the axis, and the axis within angle t of the direction to the center, so dot(n, p - camera) >= dist * cos(t + a) - radius for every point p of the sphere.
+    //Both angles are at most 90 degrees when the test can succeed, so cos(t + a) is expanded without wrapping around.
+    //(The test is skipped while the camera is inside the sphere, until it is dist - radius outside.)
+    if ((mask & CULL_FACING) && f.coneCos > 0)
+    {
+        if (dist <= radius) margin = std::min(margin, radius - dist);
+        else
+        {
+            vfloat cosA = f.coneCos, sinA = std::sqrt(1 - cosA * cosA);
+            vfloat along = glm::dot(vvec3(f.normal), toCenter);
+            vfloat across = std::sqrt(std::max(dist * dist - along * along, static_cast<vfloat>(0)));
+            vfloat away = along * cosA - across * sinA - radius, toward = -along * cosA - across * sinA - radius;
+            if (away > 0) { margin = std::min(margin, away); return false; }
+            if (toward > 0) mask &= ~CULL_FACING;
+            margin = std::min(margin, std::min(-away, std::abs(toward)));
+        }
+    }
+    for (unsigned int i = 0; i<volume.planes.size(); i++)
+    {
+        if (!(mask & (CULL_FRUSTUM << i))) continue;
+        vfloat d = glm::dot(vvec3(volume.planes[i]), center) + volume.planes[i].w;
+        if (d < -radius) { margin = std::min(margin, -radius - d); return false; }
+        if (d > radius) mask &= ~(CULL_FRUSTUM << i);
+        margin = std::min(margin, std::min(d + radius, std::abs(d - radius)));
+    }
+    return true;
+}
 
-//TODO: need new, more efficent RNG
-double Planet::randvfloat(double seedx, double seedy)
+vvec3 Planet::faceNormal(const Face& f) const
 {
-    vfloat fract;
-    return std::modf(std::sin((12.9898 * (seedx+SEED) + 78.233 * (seedy+SEED))*437586142312314.5453), &fract);
+    const vvec3& v0 = vertexPosition(f.vertices[0]);
+    return glm::normalize(glm::cross(v0-vertexPosition(f.vertices[1]), v0-vertexPosition(f.vertices[2])));
 }
-double Planet::randvfloat(glm::dvec2 vec)
+
+vfloat Planet::splitPriority(const Face& f, const vvec3& camera) const
 {
-    return randvfloat(vec.x, vec.y);
+    vfloat dist = std::max(std::max(
+                                    glm::length(camera - vertexPosition(f.vertices[0])),
+                                    glm::length(camera - vertexPosition(f.vertices[1]))),
+                           glm::length(camera - vertexPosition(f.vertices[2])));
+    return lodMetric->Priority(dist, f.level, f.error);
 }
 
-glm::dvec2 Planet::sphericalCoordinates(vvec3 pos)
+vfloat Planet::mergePriority(const Face& f, const vvec3& camera) const
 {
-    return glm::dvec2(std::acos(pos.z / sqrt(pos.x * pos.x + pos.y * pos.y + pos.z * pos.z)),std::atan2(pos.y, pos.x));
+    //the children of a flat or submerged face only cost triangles
+    if (isFlat(f) || isSubmerged(f)) return 0;
+    vfloat dist = std::min(std::min(
+                                    glm::length(camera - vertexPosition(f.vertices[0])),
+                                    glm::length(camera - vertexPosition(f.vertices[1]))),
+                           glm::length(camera - vertexPosition(f.vertices[2])));
+    //faces refined for the predicted position are kept until the camera has passed them
+    if (speculating)
+        for (int i = 0; i<3; i++)
+            dist = std::min(dist, glm::length(predictedCamera - vertexPosition(f.vertices[i])));
+    return lodMetric->Priority(dist, f.level, f.error);
 }
 
+vfloat Planet::queuedSplitPriority(const Face& f, const vvec3& camera) const
+{
+    vfloat priority = splitPriority(f, camera);
+    if (priority > 1 || !speculating) return priority > 1 ? priority : 0;
+    vfloat predicted = splitPriority(f, predictedCamera);
+    return predicted > 1 ? predicted / (1 + predicted) : 0;
+}
 
-double Planet::terrainNoise(double theta, double phi)
+vvec3 Planet::faceCenter(const Face& f) const
 {
-//    vfloat h = RandomUtils::Uniform<vfloat>(0,0.01);
-    double h = 0.01*randvfloat(theta,phi);
-    if (h<PlanetInfo.SeaLevel-0.1) h=0.9*(h-PlanetInfo.SeaLevel) + PlanetInfo.SeaLevel;
-    return h;//0.9 * sin(sin(((0.1*x + 0.1*y - 0.001*z))*0.1)) + 0.005*sin(sin((x + y + z)*100));
+    return (vertexPosition(f.vertices[0]) + vertexPosition(f.vertices[1]) + vertexPosition(f.vertices[2]))/(static_cast<vfloat>(3));
 }
 
-double Planet::terrainNoise(glm::dvec2 polarCoords)
+
+
+bool Planet::isSubmerged(const Face& f) const
+{
+    if (!oceanMode) return false;
+    vfloat highest = std::max(std::max(glm::length(vertexPosition(f.vertices[0])), glm::length(vertexPosition(f.vertices[1]))), glm::length(vertexPosition(f.vertices[2])));
+    return highest * reliefFactor[std::min(static_cast<unsigned int>(f.level), static_cast<unsigned int>(reliefFactor.size() - 1))] < Radius + PlanetInfo.SeaLevel;
+}
+
+vfloat Planet::heightScale(unsigned int level) const
 {
-    return terrainNoise(polarCoords.x,polarCoords.y);
+    //proportional to 2^(-LOD) * nonlinear factor
+    //the nonlinear factor is LOD^(TERRAIN_REGULARITY)
+    //if the nonlinear factor is 1, the terrain is boring -- this is introduced to make higher-frequency noise more noticeable.
+    return static_cast<vfloat>(3.)/static_cast<vfloat>(1 << level)*std::pow(static_cast<vfloat>(level+1), TERRAIN_REGULARITY);
+}
+
+double Planet::terrainHeight(double noiseValue) const
+{
+    //gradient noise stays well inside [-1,1] most of the time, so it is scaled up a little compared to the uniform noise it replaced
+    double h = 0.025*noiseValue;
+    if (h<PlanetInfo.SeaLevel-0.1) h=0.9*(h-PlanetInfo.SeaLevel) + PlanetInfo.SeaLevel;
+    return h;
 }
 
@@ -0,0 +1,50 @@
+//
+//  RangeAllocator.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#include "RangeAllocator.h"
+
+RangeAllocator::RangeAllocator() : end(0), used(0)
+{
+}
+
+RangeAllocator::Range RangeAllocator::Allocate(std::size_t size)
+{
+    std::size_t capacity = MIN_CAPACITY;
+    std::size_t sizeClass = 0;
+    while (capacity < size)
+    {
+        capacity <<= 1;
+        sizeClass++;
+    }
+    used += capacity;
+    if (sizeClass < freeRanges.size() && !freeRanges[sizeClass].empty())
+    {
+        std::size_t offset = freeRanges[sizeClass].back();
+        freeRanges[sizeClass].pop_back();
+        return Range(offset, capacity);
+    }
+    //nothing of this size to reuse, so the range is taken from the end of the buffer
+    Range range(end, capacity);
+    end += capacity;
+    return range;
+}
+
+void RangeAllocator::Free(const Range& range)
+{
+    if (range.capacity==0) return;
+    std::size_t sizeClass = 0;
+    for (std::size_t capacity = MIN_CAPACITY; capacity < range.capacity; capacity <<= 1) sizeClass++;
+    if (sizeClass >= freeRanges.size()) freeRanges.resize(sizeClass + 1);
+    freeRanges[sizeClass].push_back(range.offset);
+    used -= range.capacity;
+}
+
+void RangeAllocator::Clear()
+{
+    freeRanges.clear();
+    end = 0;
+    used = 0;
+}
@@ -0,0 +1,44 @@
+//
+//  RangeAllocator.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include <vector>
+#include <cstddef>
+
+///Hands out ranges of a growable buffer (in elements, not bytes) so that blocks of data can be replaced in place.
+///Range sizes are rounded up to powers of two and freed ranges are kept in one list per size, so a block whose size changes a little usually keeps its range.
+///Only the bookkeeping is done here; the owner keeps the actual buffer at least Size() elements long.
+class RangeAllocator
+{
+public:
+    struct Range
+    {
+        std::size_t offset;
+        std::size_t capacity;
+        Range() : offset(0), capacity(0) {}
+        Range(std::size_t _offset, std::size_t _capacity) : offset(_offset), capacity(_capacity) {}
+    };
+
+    RangeAllocator();
+
+    ///Returns a range of at least size elements
+    Range Allocate(std::size_t size);
+    ///Returns a range to the allocator.  Empty ranges are ignored.
+    void Free(const Range& range);
+    ///Forgets every range handed out
+    void Clear();
+    ///number of elements the buffer must hold to contain every range handed out
+    inline std::size_t Size() const { return end; }
+    ///number of elements in ranges currently handed out
+    inline std::size_t Used() const { return used; }
+private:
+    ///smallest range handed out (in elements)
+    static const std::size_t MIN_CAPACITY = 16;
+    ///freed ranges, by log2 of their capacity
+    std::vector<std::vector<std::size_t>> freeRanges;
+    std::size_t end;
+    std::size_t used;
+};
@@ -0,0 +1,94 @@
+//
+//  SlabPool.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+///Slab allocator addressed by 32-bit indices.
+///Elements are handed out in blocks of BLOCK_SIZE contiguous entries (the face tree allocates four siblings at a time, vertices are allocated one by one).
+///Slabs are never moved or released while the pool is alive, so an index (or a reference obtained from one) stays valid until its block is freed.
+///Freed blocks are reused before a new slab is reserved, which keeps split/merge churn off the general-purpose heap.
+template<typename T, std::size_t BLOCK_SIZE>
+class SlabPool
+{
+public:
+    struct Stats
+    {
+        ///elements currently handed out
+        std::size_t LiveNodes;
+        ///largest value LiveNodes has reached
+        std::size_t PeakNodes;
+        ///memory held by the pool's slabs (used or not)
+        std::size_t BytesReserved;
+    };
+    
+    static const std::uint32_t NULL_INDEX = 0xFFFFFFFFu;
+    static const std::uint32_t SLAB_SHIFT = 12;
+    static const std::uint32_t SLAB_SIZE = 1u << SLAB_SHIFT;
+    ///the slab table is reserved up front so lookups never race with it growing
+    static const std::size_t MAX_SLABS = 4096;
+    
+    SlabPool() : liveNodes(0), peakNodes(0) { slabs.reserve(MAX_SLABS); }
+    ~SlabPool()
+    {
+        for (T* slab : slabs) delete[] slab;
+    }
+    
+    ///Returns the index of the first of BLOCK_SIZE contiguous elements
+    std::uint32_t AllocateBlock()
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (freeBlocks.empty()) reserveSlab();
+        std::uint32_t block = freeBlocks.back();
+        freeBlocks.pop_back();
+        liveNodes+=BLOCK_SIZE;
+        if (liveNodes>peakNodes) peakNodes=liveNodes;
+        return block;
+    }
+    ///Returns a block obtained from AllocateBlock to the pool
+    void FreeBlock(std::uint32_t block)
+    {
+        if (block==NULL_INDEX) return;
+        std::lock_guard<std::mutex> lock(poolMutex);
+        freeBlocks.push_back(block);
+        liveNodes-=BLOCK_SIZE;
+    }
+    
+    inline T& operator[](std::uint32_t index) { return slabs[index >> SLAB_SHIFT][index & (SLAB_SIZE-1)]; }
+    inline const T& operator[](std::uint32_t index) const { return slabs[index >> SLAB_SHIFT][index & (SLAB_SIZE-1)]; }
+    
+    Stats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        return Stats{liveNodes, peakNodes, slabs.size() * SLAB_SIZE * sizeof(T)};
+    }
+private:
+    SlabPool(const SlabPool&);
+    SlabPool& operator=(const SlabPool&);
+    
+    void reserveSlab()
+    {
+        if (slabs.size()==MAX_SLABS) throw std::length_error("SlabPool is out of slabs");
+        std::uint32_t base = static_cast<std::uint32_t>(slabs.size()) << SLAB_SHIFT;
+        slabs.push_back(new T[SLAB_SIZE]);
+        freeBlocks.reserve(slabs.size() * (SLAB_SIZE / BLOCK_SIZE));
+        //push in reverse so blocks are handed out in address order
+        for (std::uint32_t i = SLAB_SIZE; i>0; i-=BLOCK_SIZE)
+            freeBlocks.push_back(base + i - BLOCK_SIZE);
+    }
+    
+    std::vector<T*> slabs;
+    std::vector<std::uint32_t> freeBlocks;
+    std::size_t liveNodes;
+    std::size_t peakNodes;
+    std::mutex poolMutex;
+};
+
+template<typename T, std::size_t BLOCK_SIZE> const std::uint32_t SlabPool<T, BLOCK_SIZE>::NULL_INDEX;
@@ -11,9 +11,9 @@
 #include "glm/gtc/type_ptr.hpp"
 SolarSystem::SolarSystem(Player& _player, GLManager& _glManager, int windowWidth, int windowHeight, const std::string& resourcePath) : player(_player), glManager(_glManager), particleSystem(0),
     PhysicalSystem(8.,0.001, resourcePath), planets{
-        new Planet(0,glm::vec3(0,-2,0), 1, 100, RandomUtils::Uniform<vfloat>(-15,25), _player, _glManager, 0.3 + 0*RandomUtils::Uniform<float>(0.05f, 0.8f)),
-        new Planet(1,glm::vec3(0,2, 0), 1, 100, RandomUtils::Uniform<vfloat>(-25,25), _player, _glManager, 0.3 + 0*RandomUtils::Uniform<float>(0.05f, 0.8f)),
-        new Planet(2,glm::vec3(0,20,0), 1, 100, RandomUtils::Uniform<vfloat>(-10,10), _player, _glManager, 0.3 + 0*RandomUtils::Uniform<float>(0.05f, 0.8f))}
+        new Planet(0,glm::vec3(0,-2,0), 1, 100, RandomUtils::Uniform<vfloat>(-15,25), _player, _glManager, taskPool, 0.3 + 0*RandomUtils::Uniform<float>(0.05f, 0.8f)),
+        new Planet(1,glm::vec3(0,2, 0), 1, 100, RandomUtils::Uniform<vfloat>(-25,25), _player, _glManager, taskPool, 0.3 + 0*RandomUtils::Uniform<float>(0.05f, 0.8f)),
+        new Planet(2,glm::vec3(0,20,0), 1, 100, RandomUtils::Uniform<vfloat>(-10,10), _player, _glManager, taskPool, 0.3 + 0*RandomUtils::Uniform<float>(0.05f, 0.8f))}
 {
 #ifdef POSTPROCESSING
     generateRenderTexture(windowWidth,windowHeight);
@@ -135,4 +135,12 @@ void SolarSystem::NextRenderMode()
     {
         p->CurrentRenderMode=currentRenderMode;
     }
+}
+
+void SolarSystem::ToggleOceanMode()
+{
+    for (Planet* p : planets)
+    {
+        p->OceanMode = !p->OceanMode;
+    }
 }
\ No newline at end of file
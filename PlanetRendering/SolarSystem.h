@@ -18,9 +18,13 @@ public:
     void Update();
     void Draw(int windowWidth, int windowHeight);
     void NextRenderMode();
+    ///switches the planets between tessellated and separately drawn oceans (see Planet::OceanMode)
+    void ToggleOceanMode();
 private:
     Player& player;
     GLManager& glManager;
+    ///worker threads shared by the planets' terrain updates (declared before planets so it outlives them)
+    TaskPool taskPool;
     std::vector<Planet*> planets;
     void addPlanet(Planet* p);
     GLuint framebuffer;
@@ -0,0 +1,126 @@
+//
+//  TaskPool.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+
+#include "TaskPool.h"
+#include <algorithm>
+
+thread_local TaskPool* TaskPool::currentPool = nullptr;
+thread_local int TaskPool::currentWorker = -1;
+
+TaskPool::TaskPool(unsigned int threadCount) :
+workerCount(threadCount!=0 ? threadCount : std::max(1u, std::thread::hardware_concurrency())),
+stopping(false), queuedTasks(0), sleepingWorkers(0)
+{
+    for (unsigned int i = 0; i<=workerCount; i++)
+        queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+    for (unsigned int i = 0; i<workerCount; i++)
+        threads.push_back(std::thread(&TaskPool::workerLoop, this, i));
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : threads) t.join();
+}
+
+int TaskPool::currentQueue() const
+{
+    return currentPool==this ? currentWorker : static_cast<int>(workerCount);
+}
+
+void TaskPool::Spawn(TaskGroup& group, const Task& task)
+{
+    group.pending++;
+    WorkQueue& queue = *queues[currentQueue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(QueuedTask{task, &group});
+        queue.size++;
+    }
+    queuedTasks++;
+    //taking the lock orders this notification after a sleeping worker's last check of queuedTasks
+    if (sleepingWorkers.load()>0)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_one();
+    }
+}
+
+void TaskPool::Wait(TaskGroup& group)
+{
+    int self = currentPool==this ? currentWorker : -1;
+    while (!group.Done())
+    {
+        if (!runOne(self)) std::this_thread::yield();
+    }
+}
+
+bool TaskPool::WantsTasks() const
+{
+    int index = currentQueue();
+    int limit = currentPool==this ? 2 : static_cast<int>(workerCount);
+    return queues[index]->size.load() < limit;
+}
+
+bool TaskPool::popBack(WorkQueue& queue, QueuedTask& task)
+{
+    if (queue.size.load()==0) return false;
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    queue.size--;
+    return true;
+}
+
+bool TaskPool::popFront(WorkQueue& queue, QueuedTask& task)
+{
+    if (queue.size.load()==0) return false;
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    queue.size--;
+    return true;
+}
+
+bool TaskPool::runOne(int self)
+{
+    QueuedTask task;
+    bool found = self>=0 && popBack(*queues[self], task);
+    //the shared queue is checked before stealing, so work handed in from outside starts promptly
+    if (!found) found = popFront(*queues[workerCount], task);
+    for (std::size_t i = 1; !found && i<=workerCount; i++)
+    {
+        std::size_t victim = (static_cast<std::size_t>(self + 1) + i) % workerCount;
+        if (static_cast<int>(victim)==self) continue;
+        found = popFront(*queues[victim], task);
+    }
+    if (!found) return false;
+    queuedTasks--;
+    task.task();
+    task.group->pending--;
+    return true;
+}
+
+void TaskPool::workerLoop(unsigned int index)
+{
+    currentPool = this;
+    currentWorker = static_cast<int>(index);
+    while (!stopping)
+    {
+        if (runOne(currentWorker)) continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers++;
+        wake.wait(lock, [this]() { return stopping || queuedTasks.load()>0; });
+        sleepingWorkers--;
+    }
+}
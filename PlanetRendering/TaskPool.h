@@ -0,0 +1,86 @@
+//
+//  TaskPool.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+///Work-stealing thread pool used to spread face tree traversals over all cores.
+///Every worker owns a queue: tasks it spawns go to the back of that queue and it runs them from the back (depth first), while idle workers steal from the front, where the oldest and therefore largest subtrees sit.
+///Threads outside the pool (e.g. a planet's update thread) spawn into a shared queue and help run tasks while they wait.
+class TaskPool
+{
+public:
+    typedef std::function<void()> Task;
+    
+    ///Counts the outstanding tasks of one job, including tasks spawned by those tasks
+    class TaskGroup
+    {
+    public:
+        TaskGroup() : pending(0) {}
+        inline bool Done() const { return pending.load()==0; }
+    private:
+        friend class TaskPool;
+        TaskGroup(const TaskGroup&);
+        TaskGroup& operator=(const TaskGroup&);
+        std::atomic<int> pending;
+    };
+    
+    ///threadCount==0 uses one worker per hardware thread
+    explicit TaskPool(unsigned int threadCount=0);
+    ~TaskPool();
+    
+    void Spawn(TaskGroup& group, const Task& task);
+    ///Runs queued tasks on the calling thread until every task of the group has finished
+    void Wait(TaskGroup& group);
+    ///True when the calling thread has little work queued, i.e. a spawned task is likely to be picked up by an idle worker.
+    ///Recursive traversals use this to decide between spawning a subtree and descending into it directly.
+    bool WantsTasks() const;
+    inline unsigned int ThreadCount() const { return workerCount; }
+private:
+    TaskPool(const TaskPool&);
+    TaskPool& operator=(const TaskPool&);
+    
+    struct QueuedTask
+    {
+        Task task;
+        TaskGroup* group;
+    };
+    struct WorkQueue
+    {
+        std::deque<QueuedTask> tasks;
+        std::mutex mutex;
+        std::atomic<int> size;
+        WorkQueue() : size(0) {}
+    };
+    
+    void workerLoop(unsigned int index);
+    ///runs one task from the queue of worker self (if any), the shared queue or another worker's queue
+    bool runOne(int self);
+    bool popBack(WorkQueue& queue, QueuedTask& task);
+    bool popFront(WorkQueue& queue, QueuedTask& task);
+    int currentQueue() const;
+    
+    //fixed before any worker starts, so workers never look at threads while it is being filled
+    const unsigned int workerCount;
+    //one queue per worker, followed by the shared queue used by outside threads
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<bool> stopping;
+    std::atomic<int> queuedTasks;
+    std::atomic<int> sleepingWorkers;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    
+    static thread_local TaskPool* currentPool;
+    static thread_local int currentWorker;
+};
@@ -0,0 +1,341 @@
+//
+//  TerrainNoise.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+
+#include "TerrainNoise.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+//The noise is written once, as templates over a "lanes" type that provides the handful of float and 32-bit integer operations it needs.
+//Instantiating it with ScalarLanes gives the reference implementation; the SIMD lane types run the very same sequence of operations on several points at once.
+namespace
+{
+    //hash multipliers of the three lattice axes
+    const std::uint32_t PRIME_X = 0x8da6b343u;
+    const std::uint32_t PRIME_Y = 0xd8163841u;
+    const std::uint32_t PRIME_Z = 0xcb1ab31fu;
+    const std::uint32_t SIGN_BIT = 0x80000000u;
+    //with the diagonal gradients each corner contributes at most 1.5 (at the cell centre), which bounds the interpolated noise as well; this brings it into [-1,1]
+    const float NOISE_SCALE = 2.0f / 3.0f;
+
+    struct ScalarLanes
+    {
+        typedef float F;
+        typedef std::uint32_t I;
+        static const std::size_t WIDTH = 1;
+        static inline F load(const float* p) { return *p; }
+        static inline void store(float* p, F a) { *p = a; }
+        static inline F set(float a) { return a; }
+        static inline I seti(std::uint32_t a) { return a; }
+        static inline F add(F a, F b) { return a + b; }
+        static inline F sub(F a, F b) { return a - b; }
+        static inline F mul(F a, F b) { return a * b; }
+        static inline F floor(F a) { return std::floor(a); }
+        static inline I toInt(F a) { return static_cast<std::uint32_t>(static_cast<std::int32_t>(a)); }
+        static inline I addi(I a, I b) { return a + b; }
+        static inline I andi(I a, I b) { return a & b; }
+        static inline I xori(I a, I b) { return a ^ b; }
+        static inline I muli(I a, I b) { return a * b; }
+        static inline I shl(I a, int n) { return a << n; }
+        static inline I shr(I a, int n) { return a >> n; }
+        static inline F flipSign(F a, I sign)
+        {
+            std::uint32_t bits;
+            std::memcpy(&bits, &a, sizeof(bits));
+            bits ^= sign;
+            std::memcpy(&a, &bits, sizeof(bits));
+            return a;
+        }
+    };
+
+#if defined(__AVX2__)
+    struct AVX2Lanes
+    {
+        typedef __m256 F;
+        typedef __m256i I;
+        static const std::size_t WIDTH = 8;
+        static inline F load(const float* p) { return _mm256_loadu_ps(p); }
+        static inline void store(float* p, F a) { _mm256_storeu_ps(p, a); }
+        static inline F set(float a) { return _mm256_set1_ps(a); }
+        static inline I seti(std::uint32_t a) { return _mm256_set1_epi32(static_cast<int>(a)); }
+        static inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+        static inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+        static inline F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+        static inline F floor(F a) { return _mm256_floor_ps(a); }
+        static inline I toInt(F a) { return _mm256_cvttps_epi32(a); }
+        static inline I addi(I a, I b) { return _mm256_add_epi32(a, b); }
+        static inline I andi(I a, I b) { return _mm256_and_si256(a, b); }
+        static inline I xori(I a, I b) { return _mm256_xor_si256(a, b); }
+        static inline I muli(I a, I b) { return _mm256_mullo_epi32(a, b); }
+        static inline I shl(I a, int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+        static inline I shr(I a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+        static inline F flipSign(F a, I sign) { return _mm256_xor_ps(a, _mm256_castsi256_ps(sign)); }
+    };
+    typedef AVX2Lanes BatchLanes;
+    const char* BATCH_NAME = "AVX2";
+#elif defined(__SSE2__) || defined(_M_X64)
+    struct SSELanes
+    {
+        typedef __m128 F;
+        typedef __m128i I;
+        static const std::size_t WIDTH = 4;
+        static inline F load(const float* p) { return _mm_loadu_ps(p); }
+        static inline void store(float* p, F a) { _mm_storeu_ps(p, a); }
+        static inline F set(float a) { return _mm_set1_ps(a); }
+        static inline I seti(std::uint32_t a) { return _mm_set1_epi32(static_cast<int>(a)); }
+        static inline F add(F a, F b) { return _mm_add_ps(a, b); }
+        static inline F sub(F a, F b) { return _mm_sub_ps(a, b); }
+        static inline F mul(F a, F b) { return _mm_mul_ps(a, b); }
+        static inline F floor(F a)
+        {
+#ifdef __SSE4_1__
+            return _mm_floor_ps(a);
+#else
+            //truncation rounds negative values up, which the comparison corrects
+            F t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+            return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+#endif
+        }
+        static inline I toInt(F a) { return _mm_cvttps_epi32(a); }
+        static inline I addi(I a, I b) { return _mm_add_epi32(a, b); }
+        static inline I andi(I a, I b) { return _mm_and_si128(a, b); }
+        static inline I xori(I a, I b) { return _mm_xor_si128(a, b); }
+        static inline I muli(I a, I b)
+        {
+#ifdef __SSE4_1__
+            return _mm_mullo_epi32(a, b);
+#else
+            //SSE2 only multiplies the even lanes, so the odd ones are shifted down and multiplied separately
+            I even = _mm_mul_epu32(a, b);
+            I odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+            return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+        }
+        static inline I shl(I a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+        static inline I shr(I a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+        static inline F flipSign(F a, I sign) { return _mm_xor_ps(a, _mm_castsi128_ps(sign)); }
+    };
+    typedef SSELanes BatchLanes;
+    const char* BATCH_NAME = "SSE2";
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    struct NEONLanes
+    {
+        typedef float32x4_t F;
+        typedef uint32x4_t I;
+        static const std::size_t WIDTH = 4;
+        static inline F load(const float* p) { return vld1q_f32(p); }
+        static inline void store(float* p, F a) { vst1q_f32(p, a); }
+        static inline F set(float a) { return vdupq_n_f32(a); }
+        static inline I seti(std::uint32_t a) { return vdupq_n_u32(a); }
+        static inline F add(F a, F b) { return vaddq_f32(a, b); }
+        static inline F sub(F a, F b) { return vsubq_f32(a, b); }
+        static inline F mul(F a, F b) { return vmulq_f32(a, b); }
+        static inline F floor(F a)
+        {
+            //truncation rounds negative values up, which the comparison corrects
+            F t = vcvtq_f32_s32(vcvtq_s32_f32(a));
+            return vsubq_f32(t, vreinterpretq_f32_u32(vandq_u32(vcgtq_f32(t, a), vreinterpretq_u32_f32(vdupq_n_f32(1.0f)))));
+        }
+        static inline I toInt(F a) { return vreinterpretq_u32_s32(vcvtq_s32_f32(a)); }
+        static inline I addi(I a, I b) { return vaddq_u32(a, b); }
+        static inline I andi(I a, I b) { return vandq_u32(a, b); }
+        static inline I xori(I a, I b) { return veorq_u32(a, b); }
+        static inline I muli(I a, I b) { return vmulq_u32(a, b); }
+        static inline I shl(I a, int n) { return vshlq_u32(a, vdupq_n_s32(n)); }
+        static inline I shr(I a, int n) { return vshlq_u32(a, vdupq_n_s32(-n)); }
+        static inline F flipSign(F a, I sign) { return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a), sign)); }
+    };
+    typedef NEONLanes BatchLanes;
+    const char* BATCH_NAME = "NEON";
+#else
+    typedef ScalarLanes BatchLanes;
+    const char* BATCH_NAME = "scalar";
+#endif
+
+    ///integer hash (lowbias32) used both for the lattice and for deriving the octave seeds
+    template<typename L>
+    inline typename L::I mix(typename L::I h)
+    {
+        h = L::xori(h, L::shr(h, 16));
+        h = L::muli(h, L::seti(0x7feb352du));
+        h = L::xori(h, L::shr(h, 15));
+        h = L::muli(h, L::seti(0x846ca68bu));
+        return L::xori(h, L::shr(h, 16));
+    }
+
+    inline std::uint32_t octaveSeed(std::uint32_t seed, std::uint32_t octave)
+    {
+        return mix<ScalarLanes>(seed + octave * 0x9e3779b9u);
+    }
+
+    ///quintic smoothstep 6t^5 - 15t^4 + 10t^3, whose first and second derivatives vanish at the lattice points
+    template<typename L>
+    inline typename L::F fade(typename L::F t)
+    {
+        return L::mul(L::mul(L::mul(t, t), t), L::add(L::mul(t, L::sub(L::mul(t, L::set(6.0f)), L::set(15.0f))), L::set(10.0f)));
+    }
+
+    template<typename L>
+    inline typename L::F lerp(typename L::F a, typename L::F b, typename L::F t)
+    {
+        return L::add(a, L::mul(t, L::sub(b, a)));
+    }
+
+    ///contribution of one lattice corner: the dot product of its gradient, one of (+-1,+-1,+-1) picked by the low bits of the hash, with the offset from the corner
+    template<typename L>
+    inline typename L::F corner(typename L::I h, typename L::F dx, typename L::F dy, typename L::F dz)
+    {
+        typename L::I sign = L::seti(SIGN_BIT);
+        return L::add(L::add(L::flipSign(dx, L::shl(h, 31)), L::flipSign(dy, L::andi(L::shl(h, 30), sign))), L::flipSign(dz, L::andi(L::shl(h, 29), sign)));
+    }
+
+    template<typename L>
+    typename L::F gradient(typename L::F x, typename L::F y, typename L::F z, typename L::I seed)
+    {
+        typedef typename L::F F;
+        typedef typename L::I I;
+        F fx = L::floor(x), fy = L::floor(y), fz = L::floor(z);
+        F tx = L::sub(x, fx), ty = L::sub(y, fy), tz = L::sub(z, fz);
+        F one = L::set(1.0f);
+        F ux = L::sub(tx, one), uy = L::sub(ty, one), uz = L::sub(tz, one);
+
+        //hash contributions of the cell's two lattice coordinates along each axis; wrapping them makes the noise periodic
+        I mask = L::seti(TerrainNoise::PERIOD - 1);
+        I ix = L::toInt(fx), iy = L::toInt(fy), iz = L::toInt(fz);
+        I x0 = L::xori(L::muli(L::andi(ix, mask), L::seti(PRIME_X)), seed);
+        I x1 = L::xori(L::muli(L::andi(L::addi(ix, L::seti(1)), mask), L::seti(PRIME_X)), seed);
+        I y0 = L::muli(L::andi(iy, mask), L::seti(PRIME_Y));
+        I y1 = L::muli(L::andi(L::addi(iy, L::seti(1)), mask), L::seti(PRIME_Y));
+        I z0 = L::muli(L::andi(iz, mask), L::seti(PRIME_Z));
+        I z1 = L::muli(L::andi(L::addi(iz, L::seti(1)), mask), L::seti(PRIME_Z));
+
+        F n000 = corner<L>(mix<L>(L::xori(L::xori(x0, y0), z0)), tx, ty, tz);
+        F n100 = corner<L>(mix<L>(L::xori(L::xori(x1, y0), z0)), ux, ty, tz);
+        F n010 = corner<L>(mix<L>(L::xori(L::xori(x0, y1), z0)), tx, uy, tz);
+        F n110 = corner<L>(mix<L>(L::xori(L::xori(x1, y1), z0)), ux, uy, tz);
+        F n001 = corner<L>(mix<L>(L::xori(L::xori(x0, y0), z1)), tx, ty, uz);
+        F n101 = corner<L>(mix<L>(L::xori(L::xori(x1, y0), z1)), ux, ty, uz);
+        F n011 = corner<L>(mix<L>(L::xori(L::xori(x0, y1), z1)), tx, uy, uz);
+        F n111 = corner<L>(mix<L>(L::xori(L::xori(x1, y1), z1)), ux, uy, uz);
+
+        F sx = fade<L>(tx), sy = fade<L>(ty), sz = fade<L>(tz);
+        F y0z0 = lerp<L>(lerp<L>(n000, n100, sx), lerp<L>(n010, n110, sx), sy);
+        F y0z1 = lerp<L>(lerp<L>(n001, n101, sx), lerp<L>(n011, n111, sx), sy);
+        return L::mul(lerp<L>(y0z0, y0z1, sz), L::set(NOISE_SCALE));
+    }
+
+    template<typename L>
+    struct GradientSampler
+    {
+        std::uint32_t seed;
+        inline typename L::F operator()(typename L::F x, typename L::F y, typename L::F z) const { return gradient<L>(x, y, z, L::seti(seed)); }
+    };
+
+    template<typename L>
+    struct FBmSampler
+    {
+        const std::uint32_t* seeds;
+        unsigned int octaves;
+        float lacunarity;
+        float gain;
+        inline typename L::F operator()(typename L::F x, typename L::F y, typename L::F z) const
+        {
+            typename L::F sum = L::set(0.0f);
+            float frequency = 1.0f, amplitude = 1.0f, totalAmplitude = 0.0f;
+            for (unsigned int i = 0; i<octaves; i++)
+            {
+                typename L::F f = L::set(frequency);
+                sum = L::add(sum, L::mul(L::set(amplitude), gradient<L>(L::mul(x, f), L::mul(y, f), L::mul(z, f), L::seti(seeds[i]))));
+                totalAmplitude += amplitude;
+                frequency *= lacunarity;
+                amplitude *= gain;
+            }
+            return totalAmplitude > 0 ? L::mul(sum, L::set(1.0f / totalAmplitude)) : sum;
+        }
+    };
+
+    ///Runs a sampler over arrays of points, a full vector at a time; the remaining points are padded to one more vector
+    template<typename L, typename Sampler>
+    void sampleBatch(const Sampler& sampler, const float* x, const float* y, const float* z, float* out, std::size_t count)
+    {
+        std::size_t i = 0;
+        for (; i + L::WIDTH <= count; i += L::WIDTH)
+            L::store(out + i, sampler(L::load(x + i), L::load(y + i), L::load(z + i)));
+        if (i==count) return;
+        float px[L::WIDTH] = {}, py[L::WIDTH] = {}, pz[L::WIDTH] = {}, result[L::WIDTH];
+        std::copy(x + i, x + count, px);
+        std::copy(y + i, y + count, py);
+        std::copy(z + i, z + count, pz);
+        L::store(result, sampler(L::load(px), L::load(py), L::load(pz)));
+        std::copy(result, result + (count - i), out + i);
+    }
+}
+
+TerrainNoise::TerrainNoise(std::uint32_t _seed) : seed(_seed)
+{
+}
+
+float TerrainNoise::Gradient(float x, float y, float z, std::uint32_t octave) const
+{
+    return gradient<ScalarLanes>(x, y, z, octaveSeed(seed, octave));
+}
+
+float TerrainNoise::FBm(float x, float y, float z, unsigned int octaves, float lacunarity, float gain) const
+{
+    std::vector<std::uint32_t> seeds(octaves);
+    for (unsigned int i = 0; i<octaves; i++) seeds[i] = octaveSeed(seed, i);
+    FBmSampler<ScalarLanes> sampler = {seeds.data(), octaves, lacunarity, gain};
+    return sampler(x, y, z);
+}
+
+void TerrainNoise::GradientBatch(const float* x, const float* y, const float* z, float* out, std::size_t count, std::uint32_t octave) const
+{
+    GradientSampler<BatchLanes> sampler = {octaveSeed(seed, octave)};
+    sampleBatch<BatchLanes>(sampler, x, y, z, out, count);
+}
+
+void TerrainNoise::FBmBatch(const float* x, const float* y, const float* z, float* out, std::size_t count, unsigned int octaves, float lacunarity, float gain) const
+{
+    std::vector<std::uint32_t> seeds(octaves);
+    for (unsigned int i = 0; i<octaves; i++) seeds[i] = octaveSeed(seed, i);
+    FBmSampler<BatchLanes> sampler = {seeds.data(), octaves, lacunarity, gain};
+    sampleBatch<BatchLanes>(sampler, x, y, z, out, count);
+}
+
+float TerrainNoise::Verify(std::size_t count) const
+{
+    //pseudorandom points in [-256,256)^3, including negative coordinates and (with count > 0) a tail shorter than a vector
+    std::vector<float> x(count), y(count), z(count), batch(count);
+    for (std::size_t i = 0; i<count; i++)
+    {
+        std::uint32_t h = mix<ScalarLanes>(static_cast<std::uint32_t>(i));
+        x[i] = static_cast<float>(h & 0xFFFF) / 128.0f - 256.0f;
+        h = mix<ScalarLanes>(h);
+        y[i] = static_cast<float>(h & 0xFFFF) / 128.0f - 256.0f;
+        h = mix<ScalarLanes>(h);
+        z[i] = static_cast<float>(h & 0xFFFF) / 128.0f - 256.0f;
+    }
+    float maxError = 0;
+    GradientBatch(x.data(), y.data(), z.data(), batch.data(), count, 1);
+    for (std::size_t i = 0; i<count; i++)
+        maxError = std::max(maxError, std::fabs(batch[i] - Gradient(x[i], y[i], z[i], 1)));
+    FBmBatch(x.data(), y.data(), z.data(), batch.data(), count, 4);
+    for (std::size_t i = 0; i<count; i++)
+        maxError = std::max(maxError, std::fabs(batch[i] - FBm(x[i], y[i], z[i], 4)));
+    return maxError;
+}
+
+const char* TerrainNoise::BatchInstructionSet()
+{
+    return BATCH_NAME;
+}
@@ -0,0 +1,40 @@
+//
+//  TerrainNoise.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+///Coherent 3D gradient noise (Perlin-style) with lattice gradients picked by an integer hash, so no permutation table or trigonometry is involved.
+///Each octave gets its own hash seed, so octaves (and the levels of the face tree, which use one octave each) are uncorrelated.
+///The batch functions evaluate several points per instruction with AVX2, SSE2 or NEON (whichever the build targets);
+///the single-point functions are the scalar reference implementation that the batch path is checked against (see Verify()).
+class TerrainNoise
+{
+public:
+    ///lattice cells after which the noise repeats along each axis.  Callers with large coordinates can wrap them into [0, PERIOD) (in double precision) without seams.
+    static const std::uint32_t PERIOD = 1 << 16;
+
+    explicit TerrainNoise(std::uint32_t seed);
+
+    ///Gradient noise at one point, in [-1,1] and 0 at every lattice point
+    float Gradient(float x, float y, float z, std::uint32_t octave = 0) const;
+    ///Fractal Brownian motion: the sum of octaves of gradient noise, each at lacunarity times the frequency and gain times the amplitude of the last; normalized to [-1,1]
+    float FBm(float x, float y, float z, unsigned int octaves, float lacunarity = 2.0f, float gain = 0.5f) const;
+
+    ///Gradient noise at count points given as separate coordinate arrays (out may alias none of them)
+    void GradientBatch(const float* x, const float* y, const float* z, float* out, std::size_t count, std::uint32_t octave = 0) const;
+    ///FBm() at count points
+    void FBmBatch(const float* x, const float* y, const float* z, float* out, std::size_t count, unsigned int octaves, float lacunarity = 2.0f, float gain = 0.5f) const;
+
+    ///Largest difference between the batch and scalar paths over count pseudorandom points
+    float Verify(std::size_t count) const;
+    ///instruction set used by the batch functions ("AVX2", "SSE2", "NEON" or "scalar")
+    static const char* BatchInstructionSet();
+    inline std::uint32_t GetSeed() const { return seed; }
+private:
+    std::uint32_t seed;
+};
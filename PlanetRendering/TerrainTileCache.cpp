@@ -0,0 +1,153 @@
+//
+//  TerrainTileCache.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+
+#include "TerrainTileCache.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char MAGIC[8] = {'P','L','N','T','T','I','L','E'};
+}
+
+TerrainTileCache::TerrainTileCache() : maxBytes(0), mapping(nullptr), mappingSize(0), header(nullptr), slots(nullptr), slotBits(0), hits(0), misses(0)
+{
+    static_assert(sizeof(Header)==64 && sizeof(Slot)==24, "the cache file layout must not depend on the compiler");
+}
+
+TerrainTileCache::~TerrainTileCache()
+{
+    Close();
+}
+
+void TerrainTileCache::Open(const std::string& _path, std::size_t _maxBytes, std::uint32_t seed)
+{
+    Close();
+    path = _path;
+    maxBytes = _maxBytes;
+
+    //the largest power of two number of slots that fits
+    if (maxBytes < sizeof(Header) + 2 * sizeof(Slot)) throw std::runtime_error("Tile cache size too small: " + std::to_string(maxBytes));
+    unsigned int bits = 1;
+    while (bits < 48 && sizeof(Header) + (std::size_t(2) << bits) * sizeof(Slot) <= maxBytes) bits++;
+    std::size_t slotCount = std::size_t(1) << bits;
+    std::size_t size = sizeof(Header) + slotCount * sizeof(Slot);
+
+    int file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (file < 0) throw std::runtime_error("Cannot open tile cache " + path + ": " + std::strerror(errno));
+
+    //an existing file is kept only if it was written by this format, for this seed, at this size
+    bool valid = false;
+    struct stat info;
+    if (fstat(file, &info)==0 && static_cast<std::size_t>(info.st_size)==size)
+    {
+        Header existing;
+        if (pread(file, &existing, sizeof(Header), 0)==static_cast<ssize_t>(sizeof(Header)))
+            valid = std::memcmp(existing.magic, MAGIC, sizeof(MAGIC))==0 && existing.version==VERSION && existing.seed==seed && existing.slotCount==slotCount;
+    }
+    //truncating to 0 first zeroes every slot (the file is sparse, so this costs no disk space until slots are used)
+    if (!valid && (ftruncate(file, 0)!=0 || ftruncate(file, static_cast<off_t>(size))!=0))
+    {
+        close(file);
+        throw std::runtime_error("Cannot resize tile cache " + path + ": " + std::strerror(errno));
+    }
+
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    //the mapping keeps its own reference to the file
+    close(file);
+    if (address==MAP_FAILED) throw std::runtime_error("Cannot map tile cache " + path + ": " + std::strerror(errno));
+
+    mapping = address;
+    mappingSize = size;
+    header = static_cast<Header*>(address);
+    slots = reinterpret_cast<Slot*>(static_cast<char*>(address) + sizeof(Header));
+    slotBits = bits;
+    if (!valid)
+    {
+        header->version = VERSION;
+        header->seed = seed;
+        header->slotCount = slotCount;
+        header->entries = 0;
+        //the magic goes last, so a file that was only partly initialized is not mistaken for a valid one
+        std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+    }
+}
+
+void TerrainTileCache::Close()
+{
+    path.clear();
+    maxBytes = 0;
+    if (!mapping) return;
+    munmap(mapping, mappingSize);
+    mapping = nullptr;
+    mappingSize = 0;
+    header = nullptr;
+    slots = nullptr;
+    slotBits = 0;
+}
+
+bool TerrainTileCache::Find(SubdivisionAddress address, HeightCache::Value& value)
+{
+    if (!slots) return false;
+    std::size_t mask = (std::size_t(1) << slotBits) - 1;
+    std::size_t slot = slotOf(address);
+    for (unsigned int probe = 0; probe < MAX_PROBES; probe++, slot = (slot + 1) & mask)
+    {
+        std::uint64_t key = slots[slot].key.load(std::memory_order_acquire);
+        if (key==address)
+        {
+            std::memcpy(value.data(), slots[slot].values, sizeof(slots[slot].values));
+            hits++;
+            return true;
+        }
+        //faces are never removed, so an empty slot ends the probe sequence
+        if (key==0 || key==(address | PENDING)) break;
+    }
+    misses++;
+    return false;
+}
+
+void TerrainTileCache::Insert(SubdivisionAddress address, const HeightCache::Value& value)
+{
+    if (!slots) return;
+    std::size_t slotCount = std::size_t(1) << slotBits;
+    if (header->entries.load(std::memory_order_relaxed) >= slotCount / 4 * 3) return;
+    std::size_t slot = slotOf(address);
+    for (unsigned int probe = 0; probe < MAX_PROBES; probe++, slot = (slot + 1) & (slotCount - 1))
+    {
+        std::uint64_t key = slots[slot].key.load(std::memory_order_acquire);
+        //another thread has stored (or is storing) the same face
+        if ((key & ~PENDING)==address) return;
+        if (key!=0) continue;
+        std::uint64_t expected = 0;
+        if (slots[slot].key.compare_exchange_strong(expected, address | PENDING))
+        {
+            std::memcpy(slots[slot].values, value.data(), sizeof(slots[slot].values));
+            slots[slot].key.store(address, std::memory_order_release);
+            header->entries++;
+            return;
+        }
+        //lost the slot to another face; it may have been this one
+        if ((expected & ~PENDING)==address) return;
+    }
+}
+
+TerrainTileCache::Stats TerrainTileCache::GetStats() const
+{
+    Stats stats;
+    stats.Hits = hits;
+    stats.Misses = misses;
+    stats.Entries = header ? static_cast<std::size_t>(header->entries.load()) : 0;
+    stats.Slots = slots ? std::size_t(1) << slotBits : 0;
+    stats.FileBytes = mappingSize;
+    return stats;
+}
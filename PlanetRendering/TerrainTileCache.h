@@ -0,0 +1,92 @@
+//
+//  TerrainTileCache.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include "HeightCache.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+///Persistent counterpart of HeightCache: the midpoint noise of faces, kept in a memory-mapped file so that later sessions (with the same seed) can read it instead of evaluating it.
+///The file is an open-addressing hash table keyed by SubdivisionAddress; a lookup reads the mapped slot directly, and pages the session never touches are never read from disk.
+///The header records the format VERSION and the noise seed, and a file that does not match either (or the requested size) is started over.
+///The table never grows past the size it was opened with: once it is three quarters full, new faces are no longer stored, so the file keeps the shallowest (first split) faces.
+///Find() and Insert() are lock-free and may be called from any number of threads; Open() and Close() may not run concurrently with them.
+class TerrainTileCache
+{
+public:
+    ///Bump whenever the file layout or the terrain noise (TerrainNoise, or the coordinates Planet samples it at) changes, so that old files are discarded
+    static const std::uint32_t VERSION = 1;
+
+    struct Stats
+    {
+        std::size_t Hits;
+        std::size_t Misses;
+        std::size_t Entries;
+        std::size_t Slots;
+        ///size of the file (most of which is not resident unless it has been used)
+        std::size_t FileBytes;
+        inline double HitRate() const { return Hits + Misses==0 ? 0.0 : static_cast<double>(Hits) / (Hits + Misses); }
+    };
+
+    TerrainTileCache();
+    ~TerrainTileCache();
+
+    ///Maps the cache file at path, holding at most maxBytes, for terrain generated with seed; throws std::runtime_error if the file cannot be created or mapped.
+    ///An open cache is closed first.  The path is remembered even if opening fails (see GetPath()), so callers can tell a failed path from a new one.
+    void Open(const std::string& path, std::size_t maxBytes, std::uint32_t seed);
+    ///Unmaps the file (whatever has been stored stays in it) and forgets the path
+    void Close();
+    inline bool IsOpen() const { return slots!=nullptr; }
+    inline const std::string& GetPath() const { return path; }
+    inline std::size_t GetMaxBytes() const { return maxBytes; }
+
+    ///Looks up the noise of a face.  Returns false on a miss (or when the cache is closed).
+    bool Find(SubdivisionAddress address, HeightCache::Value& value);
+    ///Stores the noise of a face, unless the table is full
+    void Insert(SubdivisionAddress address, const HeightCache::Value& value);
+
+    Stats GetStats() const;
+private:
+    TerrainTileCache(const TerrainTileCache&);
+    TerrainTileCache& operator=(const TerrainTileCache&);
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t seed;
+        std::uint64_t slotCount;
+        std::atomic<std::uint64_t> entries;
+        char reserved[32];
+    };
+    struct Slot
+    {
+        ///address of the face stored here (0 if empty, with PENDING set while its values are being written)
+        std::atomic<std::uint64_t> key;
+        float values[3];
+        std::uint32_t reserved;
+    };
+    ///set on a claimed slot until its values are written; addresses are at most 2*MAX_LOD+6 bits long, so this never collides with one
+    static const std::uint64_t PENDING = 1ull << 63;
+    ///slots examined before a lookup gives up
+    static const unsigned int MAX_PROBES = 32;
+
+    inline std::size_t slotOf(SubdivisionAddress address) const
+    {
+        return static_cast<std::size_t>((address * 0x9E3779B97F4A7C15ull) >> (64 - slotBits));
+    }
+
+    std::string path;
+    std::size_t maxBytes;
+    void* mapping;
+    std::size_t mappingSize;
+    Header* header;
+    Slot* slots;
+    unsigned int slotBits;
+    std::atomic<std::size_t> hits;
+    std::atomic<std::size_t> misses;
+};
@@ -0,0 +1,45 @@
+//
+//  TripleBuffer.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include <array>
+#include <atomic>
+
+///Lock-free triple buffer handing whole objects from one producer thread to one consumer thread.
+///The producer fills Back() and publishes it by atomically swapping it with the shared slot; the consumer swaps the newest published object into Front().
+///Neither side ever waits for the other or copies the other's object.
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : back(0), shared(1), front(2) {}
+    
+    ///Producer: the object to fill for the next publication.  It still holds whatever the producer published two versions ago.
+    inline T& Back() { return buffers[back]; }
+    ///Producer: makes Back() the newest version and takes over the buffer it replaces
+    inline void Publish() { back = shared.exchange(back | FRESH) & INDEX_MASK; }
+    
+    ///Consumer: swaps in the newest published version, if one arrived since the last call.  Returns whether Front() changed.
+    inline bool Acquire()
+    {
+        if (!(shared.load() & FRESH)) return false;
+        front = shared.exchange(front) & INDEX_MASK;
+        return true;
+    }
+    inline const T& Front() const { return buffers[front]; }
+private:
+    TripleBuffer(const TripleBuffer&);
+    TripleBuffer& operator=(const TripleBuffer&);
+    
+    //the shared slot stores a buffer index, plus FRESH while the consumer has not taken it yet
+    static const unsigned int FRESH = 4;
+    static const unsigned int INDEX_MASK = 3;
+    
+    std::array<T, 3> buffers;
+    unsigned int back;
+    std::atomic<unsigned int> shared;
+    unsigned int front;
+};
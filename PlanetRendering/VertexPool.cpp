@@ -0,0 +1,31 @@
+//
+//  VertexPool.cpp
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+
+#include "VertexPool.h"
+
+VertexPool::VertexPool() : sharedMidpoints(0) {}
+
+VertexIndex VertexPool::AddCorner(const TerrainVertex& vertex)
+{
+    VertexIndex index = vertices.AllocateBlock();
+    vertices[index] = vertex;
+    vertices[index].refCount = 1;
+    return index;
+}
+
+VertexIndex VertexPool::ReleaseMidpoint(VertexIndex a, VertexIndex b)
+{
+    std::uint64_t key = edgeKey(a,b);
+    Shard& shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.midpoints.find(key);
+    if (it==shard.midpoints.end()) return NULL_VERTEX;
+    VertexIndex index = it->second;
+    if (--vertices[index].refCount!=0) return NULL_VERTEX;
+    shard.midpoints.erase(it);
+    return index;
+}
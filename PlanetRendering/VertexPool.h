@@ -0,0 +1,89 @@
+//
+//  VertexPool.h
+//  PlanetRendering
+//
+//  Copyright (c) 2015 Christian. All rights reserved.
+//
+#pragma once
+#include "Face.h"
+#include "SlabPool.h"
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <atomic>
+#include <array>
+
+///Storage for the vertices referenced by the face tree.
+///Edge midpoints are shared: the first face to split an edge creates its midpoint, and the neighbour across that edge reuses it when it splits.
+///Each midpoint counts the splits using it and is freed when the last of them is combined.
+///The edge map is split into shards with their own locks, so subtrees refined on different threads rarely wait on each other.
+class VertexPool
+{
+public:
+    typedef SlabPool<TerrainVertex, 1>::Stats Stats;
+    
+    VertexPool();
+    
+    ///Adds a vertex that is not an edge midpoint (the base icosahedron corners).  These are never freed.
+    VertexIndex AddCorner(const TerrainVertex& vertex);
+    ///Returns the midpoint of edge (a,b).  create() is only called (and terrain noise only evaluated) if no face has split that edge yet.
+    template<typename F>
+    VertexIndex AcquireMidpoint(VertexIndex a, VertexIndex b, F create);
+    ///Drops one reference to the midpoint of edge (a,b).  Once neither face along the edge is split, the midpoint is taken out of the edge map and returned,
+    ///and the caller frees it with Free() when nothing can read it any more; otherwise NULL_VERTEX is returned.
+    VertexIndex ReleaseMidpoint(VertexIndex a, VertexIndex b);
+    ///Returns a vertex given up by ReleaseMidpoint to the pool
+    void Free(VertexIndex index) { vertices.FreeBlock(index); }
+    
+    inline TerrainVertex& operator[](VertexIndex index) { return vertices[index]; }
+    inline const TerrainVertex& operator[](VertexIndex index) const { return vertices[index]; }
+    
+    Stats GetStats() { return vertices.GetStats(); }
+    ///number of midpoint requests answered by an existing vertex
+    std::size_t SharedMidpoints() const { return sharedMidpoints.load(); }
+private:
+    VertexPool(const VertexPool&);
+    VertexPool& operator=(const VertexPool&);
+    
+    static inline std::uint64_t edgeKey(VertexIndex a, VertexIndex b)
+    {
+        if (a>b) std::swap(a,b);
+        return (static_cast<std::uint64_t>(a) << 32) | b;
+    }
+    
+    static const unsigned int SHARD_COUNT = 64;
+    struct Shard
+    {
+        std::unordered_map<std::uint64_t, VertexIndex> midpoints;
+        std::mutex mutex;
+    };
+    inline Shard& shardOf(std::uint64_t key)
+    {
+        //mix both vertex indices so that the edges of one face land in different shards
+        return shards[((key >> 32) * 0x9E3779B1u + key) % SHARD_COUNT];
+    }
+    
+    SlabPool<TerrainVertex, 1> vertices;
+    std::array<Shard, SHARD_COUNT> shards;
+    std::atomic<std::size_t> sharedMidpoints;
+};
+
+template<typename F>
+VertexIndex VertexPool::AcquireMidpoint(VertexIndex a, VertexIndex b, F create)
+{
+    std::uint64_t key = edgeKey(a,b);
+    Shard& shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.midpoints.find(key);
+    if (it!=shard.midpoints.end())
+    {
+        vertices[it->second].refCount++;
+        sharedMidpoints++;
+        return it->second;
+    }
+    VertexIndex index = vertices.AllocateBlock();
+    vertices[index] = create();
+    vertices[index].refCount = 1;
+    shard.midpoints[key] = index;
+    return index;
+}
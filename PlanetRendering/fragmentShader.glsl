@@ -19,7 +19,7 @@ out vec4 color;
 in float height;
 in float latitude;
 in vec3 fragNormal;
-in vec2 uv;
+in vec3 texDirection;
 uniform sampler2D terrainTexture;
 uniform sampler2D normalTexture;
 
@@ -44,6 +44,7 @@ uniform vec3 sunDir = vec3(1.0,0.0,0.0);
 const float ambientLight=0.1;
 
 float rand(vec2 co);
+vec4 triplanar(sampler2D tex, vec3 p, vec3 weights);
 const int numLevels=1;
 const float textureScaling=10;
 
@@ -70,17 +71,23 @@ void main()
     interp = clamp(10.*(height-seaLevel),0,1);
     interp*=interp*interp*interp*interp*interp*10000.;
     //color = color - (color - vec4(1,1,1,1))*interp;WD
-    vec2 newU = ((uv+vec2(0.0,0.0)))*0.5*textureScaling;
+    //triplanar mapping: each texture is projected along the three axes and blended by how closely the direction from the centre follows each one,
+    //so there is no seam, no singularity at the poles, no hemisphere mirroring the other and no stretching where a projection is edge-on
+    vec3 weights = abs(texDirection);
+    weights *= weights;
+    weights *= weights;
+    weights /= weights.x + weights.y + weights.z;
+    vec3 newU = texDirection*0.5*textureScaling;
     
     vec3 norm=vec3(0,0,0);
     // + texture(normalTexture,newU).xyz + texture(normalTexture,newU*0.1).xyz + texture(normalTexture,newU*10).xyz;
     for (int i = 0; i<numLevels;i++)
-        norm+=texture(normalTexture, newU / (1 << i)).xyz;
+        norm+=triplanar(normalTexture, newU / (1 << i), weights).xyz;
     norm=normalize(norm/numLevels/3+fragNormal);
     float lightness = clamp(dot(sunDir, norm),0,1);
     float mult=0;
     for (int i = 0; i<numLevels;i++)
-        mult+=texture(terrainTexture, newU / (1 << i)).r;
+        mult+=triplanar(terrainTexture, newU / (1 << i), weights).r;
 //    color*=mult/numLevels;
 //    color=vec3(newU,0.5);
     color*=ambientLight + (1-ambientLight) * (lightness + (1-newSpec) * pow(lightness,100));//vec4(fragNormal,1.0);
@@ -91,4 +98,11 @@ void main()
 
 float rand(vec2 co){
     return fract(sin(dot(co.xy ,vec2(12.9898,78.233))) * 43758.5453);
-}
\ No newline at end of file
+}
+
+vec4 triplanar(sampler2D tex, vec3 p, vec3 weights)
+{
+    //opposite sides of the sphere are shifted apart so that they do not repeat each other
+    vec3 offset = sign(p)*0.37;
+    return texture(tex, p.yz + offset.x)*weights.x + texture(tex, p.zx + offset.y)*weights.y + texture(tex, p.xy + offset.z)*weights.z;
+}
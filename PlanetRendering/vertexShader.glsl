@@ -17,7 +17,6 @@
 #endif
 
 layout (location = 0) in vvec3 vertexPos;
-layout (location = 1) in vvec2 textureCoord;
 layout (location = 2) in vvec3 normal;
 
 layout(packed) uniform planet_info
@@ -35,11 +34,14 @@ layout(packed) uniform planet_info
 };
 
 uniform float time;
+//0 where the water is drawn separately (Planet's ocean mode)
+uniform float waveScale = 1.0;
 
 out float height;
 out float latitude;
 out vec3 fragNormal;
-out vec2 uv;
+//position on the unit sphere, from which the fragment shader maps the detail textures
+out vec3 texDirection;
 
 const vfloat waveAmplitude = 0.00001;
 const float waveFrequency = 10.;
@@ -51,12 +53,12 @@ void main()
     height = float(length(vertexPos))-radius;
     latitude = float(vertexPos.z);
     fragNormal = vec3(normal);
-    vfloat mult =(1. + waveAmplitude * vfloat(cos(waveFrequency*time +float(waveNumber*(vertexPos.x + vertexPos.y + vertexPos.z)))));
+    vfloat mult =(1. + waveScale * waveAmplitude * vfloat(cos(waveFrequency*time +float(waveNumber*(vertexPos.x + vertexPos.y + vertexPos.z)))));
     vfloat oceanInterp =clamp(10000.*(height-seaLevel), 0, 1);
     mult = mult - (mult - 1.)*oceanInterp;
     vec4 posvec =vec4(transformMatrix * (vec4(mult,mult,mult,1.0)*vec4(vertexPos,1.0)));
 //    posvec.z = log2(posvec.z/256+1);
-    uv = textureCoord;
+    texDirection = vec3(vertexPos) / radius;
     const float C = 0.01;
     posvec.z = (2 * log2(C*posvec.w + 1)) / log(C * 200. + 1) * posvec.w;
     
@@ -0,0 +1,7 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#define HAVE_STDINT_H 1
+#define HAVE_STDARG_H 1
+#define HAVE_STDDEF_H 1